@@ -0,0 +1,87 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+
+#include "tiledecoder.h"
+
+static const int TILES = 384;
+static const int ROUNDS = 20000;
+
+/* The per-pixel bit extraction the renderer used before the tile cache */
+static void decodeTileShifts(const byte *data, byte *pixels, byte *flipped)
+{
+    for (int y = 0; y < 8; y++) {
+        byte byte1 = data[y * 2];
+        byte byte2 = data[y * 2 + 1];
+
+        for (int x = 0; x < 8; x++) {
+            int i;
+            if (x == 0)
+                i = (byte1 & 1) + ((byte2 & 1) << 1);
+            else
+                i = ((byte1 & (1 << x)) >> (x))
+                  + ((byte2 & (1 << x)) >> (x-1));
+            pixels[y * 8 + 7 - x] = i;
+            flipped[y * 8 + x] = i;
+        }
+    }
+}
+
+static byte vram[TILES * 16];
+static byte pixels[TILES * 64], flipped[TILES * 64];
+static byte expectedPixels[TILES * 64], expectedFlipped[TILES * 64];
+static volatile int sink;
+
+static void run(const char *name, TileDecoder decode)
+{
+    memset(pixels, 0, sizeof(pixels));
+    memset(flipped, 0, sizeof(flipped));
+    for (int tile = 0; tile < TILES; ++tile)
+        decode(vram + tile * 16, pixels + tile * 64, flipped + tile * 64);
+    if (memcmp(pixels, expectedPixels, sizeof(pixels)) || memcmp(flipped, expectedFlipped, sizeof(flipped))) {
+        printf("%-8s decodes differently\n", name);
+        exit(1);
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int round = 0; round < ROUNDS; ++round) {
+        for (int tile = 0; tile < TILES; ++tile)
+            decode(vram + tile * 16, pixels + tile * 64, flipped + tile * 64);
+        // Keep the compiler from dropping the work
+        sink += pixels[round % sizeof(pixels)];
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("%-8s %6.2f ns per tile row\n", name, seconds * 1e9 / ((double)ROUNDS * TILES * 8));
+}
+
+int main()
+{
+    srand(1);
+    for (size_t i = 0; i < sizeof(vram); ++i)
+        vram[i] = rand();
+    for (int tile = 0; tile < TILES; ++tile)
+        decodeTileShifts(vram + tile * 16, expectedPixels + tile * 64, expectedFlipped + tile * 64);
+
+    run("shifts", decodeTileShifts);
+    run("scalar", decodeTileScalar);
+#ifdef TILE_DECODER_X86
+    if (__builtin_cpu_supports("sse2"))
+        run("sse2", decodeTileSSE2);
+    if (__builtin_cpu_supports("bmi2"))
+        run("bmi2", decodeTileBMI2);
+#endif
+
+    TileDecoder best = bestTileDecoder();
+    const char *name = "scalar";
+#ifdef TILE_DECODER_X86
+    if (best == decodeTileSSE2)
+        name = "sse2";
+    else if (best == decodeTileBMI2)
+        name = "bmi2";
+#endif
+    printf("selected %s\n", name);
+    return 0;
+}
@@ -0,0 +1,329 @@
+#include <cstring>
+
+#include "blockcache.h"
+#include "cpu.h"
+#include "debugger.h"
+#include "instructions.h"
+#include "memory.h"
+
+static bool endsBlock(const Instruction *instruction)
+{
+    static const char *mnemonics[] = { "JP", "JR", "CALL", "RET", "RST", "EI", "HALT", "STOP", 0 };
+
+    for (const char **m = mnemonics; *m; ++m)
+        if (strncmp(instruction->mnemonic, *m, strlen(*m)) == 0)
+            return true;
+    return false;
+}
+
+BlockCache::BlockCache(CPU *cpu) : cpu(cpu), recompiler(0)
+{
+    blocks = new Block*[0x10000];
+    memset(blocks, 0, sizeof(Block *) * 0x10000);
+    memset(codeMap, 0, sizeof(codeMap));
+}
+
+BlockCache::~BlockCache()
+{
+    flush();
+    for (std::vector<Block *>::iterator it = retired.begin(); it != retired.end(); ++it)
+        delete *it;
+    delete [] blocks;
+    delete recompiler;
+}
+
+bool BlockCache::setRecompiler(bool enabled)
+{
+    if (enabled == (recompiler != 0))
+        return true;
+
+    flush();
+    if (enabled) {
+        if (!Recompiler::supported())
+            return false;
+        recompiler = new Recompiler(cpu);
+    } else {
+        delete recompiler;
+        recompiler = 0;
+    }
+    return true;
+}
+
+int BlockCache::bankFor(word address) const
+{
+    return cpu->memory->bankAt(address);
+}
+
+bool BlockCache::cacheable(word address) const
+{
+    // Leave echo RAM, OAM, IO registers and IE to the interpreter
+    return address < 0xe000 || (address >= 0xff80 && address < 0xffff);
+}
+
+Block * BlockCache::find(word address)
+{
+    if (!retired.empty()) {
+        for (std::vector<Block *>::iterator it = retired.begin(); it != retired.end(); ++it)
+            delete *it;
+        retired.clear();
+    }
+
+    Block *block = blocks[address.value()];
+    if (block) {
+        if (block->bank == bankFor(address))
+            return block;
+        retire(block);
+    }
+
+    block = compile(address);
+    if (!block)
+        return 0;
+
+    if (recompiler) {
+        if (recompiler->full()) {
+            // Start over with an empty code buffer
+            flush();
+            recompiler->reset();
+        }
+        block->native = recompiler->compile(block);
+    }
+
+    blocks[address.value()] = block;
+    return block;
+}
+
+Block * BlockCache::compile(word address)
+{
+    if (!cacheable(address))
+        return 0;
+
+    // A block never crosses the bank or region it starts in
+    word_t pc = address.value();
+    word_t limit;
+    if (pc < 0x4000)
+        limit = 0x4000;
+    else if (pc < 0x8000)
+        limit = 0x8000;
+    else if (pc < 0xe000)
+        limit = 0xe000;
+    else
+        limit = 0xffff;
+
+    Block *block = new Block();
+    block->start = address;
+    block->bank = bankFor(address);
+    block->valid = true;
+    block->cycles = 0;
+    block->idleCycles = 0;
+    block->native = 0;
+
+    Memory *memory = cpu->memory;
+    while ((int)block->ops.size() < MAX_BLOCK_OPS) {
+        word_t code = memory->getRef(pc);
+        if (code == 0xcb) {
+            if (pc + 1 >= limit)
+                break;
+            code = 0x100 | memory->getRef(pc + 1);
+        }
+
+        Instruction *instruction = cpu->decodeInstruction(code);
+        if (!instruction)
+            break;
+
+        MicroOp op;
+        op.execute = instruction->execute;
+        op.condition = instruction->condition;
+        op.prefix = code > 0xff ? 2 : 1;
+        op.length = instruction->length;
+        op.cycles0 = instruction->cycles0;
+        op.cycles1 = instruction->cycles1;
+
+        if (pc + op.length > limit)
+            break;
+
+        block->ops.push_back(op);
+        if (!op.condition)
+            block->cycles += op.cycles0;
+        pc += op.length;
+
+        if (endsBlock(instruction))
+            break;
+    }
+
+    if (block->ops.empty()) {
+        delete block;
+        return 0;
+    }
+
+    block->end = pc;
+    block->idleCycles = idleLoopCycles(block);
+
+    // Remember which writable bytes hold code
+    if (address >= 0x8000) {
+        for (word_t a = address.value(); a != pc; ++a) {
+            codeMap[a >> 3] |= (1 << (a & 7));
+            memory->setPageFlags(a >> 8, PAGE_CODE, true);
+        }
+    }
+
+    return block;
+}
+
+/*
+ * Addresses whose value only changes through CPU writes or in scheduled
+ * events: ROM, VRAM, work RAM, OAM, HRAM, the joypad and serial registers,
+ * IF, and the LCD registers, whose LY and mode bits the PPU updates in its
+ * events. DIV and TIMA follow the cycle counter, and cartridge RAM may be a
+ * clock register, so loops polling anything else are not skipped.
+ */
+static bool changesOnlyAtEvents(word_t address)
+{
+    return address < 0xa000 ||
+           (address >= 0xc000 && address < 0xe000) ||
+           (address >= 0xfe00 && address < 0xfea0) ||
+           address == 0xff00 || address == 0xff01 || address == 0xff02 || address == 0xff0f ||
+           (address >= 0xff40 && address < 0xff4c) ||
+           address >= 0xff80;
+}
+
+/*
+ * A loop which branches back to its own start and only loads A from a fixed
+ * address, then tests A, produces the same registers and flags on every
+ * iteration until the polled value changes. The loop writes nothing, so if
+ * the polled address only changes in events it stays idle until the next
+ * one.
+ */
+int BlockCache::idleLoopCycles(const Block *block) const
+{
+    Memory *memory = cpu->memory;
+    const MicroOp &last = block->ops.back();
+    word_t address = block->start.value();
+    word_t branch = address;
+
+    for (size_t i = 0; i + 1 < block->ops.size(); ++i)
+        branch += block->ops[i].length;
+
+    byte code = memory->getRef(branch);
+    word_t target;
+    if ((code & 0xe7) == 0x20)
+        target = branch + 2 + (signed_byte)memory->getRef(branch + 1);      // JR cc,r8
+    else if ((code & 0xe7) == 0xc2)
+        target = word(memory->getRef(branch + 1), memory->getRef(branch + 2)).value();  // JP cc,a16
+    else
+        return 0;
+    if (target != address)
+        return 0;
+
+    bool loaded = false;
+    while (address != branch) {
+        code = memory->getRef(address);
+        word_t polled = 0;
+        if (code == 0xf0)
+            polled = 0xff00 + memory->getRef(address + 1);                   // LDH A,(a8)
+        else if (code == 0xfa)
+            polled = word(memory->getRef(address + 1), memory->getRef(address + 2)).value();  // LD A,(a16)
+
+        if (polled) {
+            if (!changesOnlyAtEvents(polled))
+                return 0;
+            loaded = true;
+        } else if (!loaded) {
+            return 0;
+        } else if (code == 0xcb) {
+            byte cb = memory->getRef(address + 1);
+            if ((cb & 0xc7) != 0x47)                                        // BIT n,A
+                return 0;
+        } else if (code != 0xfe && code != 0xe6 && code != 0xee && code != 0xf6 &&  // CP/AND/XOR/OR d8
+                   code != 0xa7 && code != 0xb7 && !(code >= 0xb8 && code <= 0xbf && code != 0xbe)) {
+            return 0;
+        }
+
+        address += code == 0xcb ? 2 : cpu->decodeInstruction(code)->length;
+    }
+
+    return block->cycles + last.cycles0;
+}
+
+void BlockCache::execute(Block *block)
+{
+    cpu->blockStopped = false;
+
+    // Native code reads immediates at translation time, which watches would miss
+    if (block->native && !cpu->debugger->isWatchingMemory()) {
+        block->native(cpu);
+        if (block->idleCycles && cpu->pc == block->start)
+            cpu->idleCycles = block->idleCycles;
+        return;
+    }
+
+    std::vector<MicroOp>::const_iterator it = block->ops.begin();
+    std::vector<MicroOp>::const_iterator last = block->ops.end() - 1;
+
+    // Cycles are counted after each op as in CPU::execute(), IO reads and writes see the same time
+    for (; it != last; ++it) {
+        cpu->pc += it->prefix;
+        it->execute(cpu);
+        cpu->cycles += it->cycles0;
+
+        // The block overwrote itself, the rest of it is stale, or it
+        // wrote a register whose effect the next op has to see
+        if (!block->valid || cpu->blockStopped)
+            return;
+    }
+
+    cpu->pc += last->prefix;
+    if (last->condition) {
+        if (last->condition(cpu)) {
+            last->execute(cpu);
+            cpu->cycles += last->cycles0;
+            if (block->idleCycles && cpu->pc == block->start && !cpu->debugger->isWatchingMemory())
+                cpu->idleCycles = block->idleCycles;
+        } else {
+            cpu->pc += last->length - last->prefix;
+            cpu->cycles += last->cycles1;
+        }
+    } else {
+        last->execute(cpu);
+        cpu->cycles += last->cycles0;
+    }
+}
+
+void BlockCache::stopBlock()
+{
+    cpu->blockStopped = true;
+}
+
+void BlockCache::retire(Block *block)
+{
+    if (blocks[block->start.value()] == block)
+        blocks[block->start.value()] = 0;
+    block->valid = false;
+    retired.push_back(block);
+}
+
+void BlockCache::invalidate(word address)
+{
+    int a = address.value();
+    int first = a >= 0x8000 + MAX_BLOCK_BYTES ? a - MAX_BLOCK_BYTES + 1 : 0x8000;
+
+    for (int start = first; start <= a; ++start) {
+        Block *block = blocks[start];
+        if (block && block->end > address)
+            retire(block);
+    }
+
+    // No block covers the address any more
+    codeMap[a >> 3] &= ~(1 << (a & 7));
+}
+
+void BlockCache::flush()
+{
+    for (int i = 0; i < 0x10000; ++i)
+        if (blocks[i])
+            retire(blocks[i]);
+    memset(codeMap, 0, sizeof(codeMap));
+
+    // Writes to RAM can take the direct path again
+    for (int page = 0x80; page < 0x100; ++page)
+        cpu->memory->setPageFlags(page, PAGE_CODE, false);
+}
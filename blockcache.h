@@ -0,0 +1,79 @@
+#ifndef BLOCKCACHE_H
+#define BLOCKCACHE_H
+
+#include <vector>
+
+#include "recompiler.h"
+#include "word.h"
+
+class CPU;
+
+/* One pre-decoded instruction of a block */
+struct MicroOp
+{
+    void (*execute)(CPU *cpu);
+    bool (*condition)(CPU *cpu);
+    byte prefix;    /* opcode bytes to skip before execute() */
+    byte length;
+    byte cycles0;
+    byte cycles1;
+};
+
+/*
+ * A straight-line run of instructions ending at a jump, call, return, RST,
+ * EI, HALT or STOP. All micro-ops but the last are unconditional.
+ */
+struct Block
+{
+    word start;
+    word end;       /* first address after the block */
+    int bank;
+    bool valid;
+    int cycles;     /* of the unconditional micro-ops */
+    int idleCycles; /* cycles per iteration if the block is an idle loop */
+    std::vector<MicroOp> ops;
+    NativeBlock native;
+};
+
+class BlockCache
+{
+private:
+    static const int MAX_BLOCK_OPS = 64;
+    static const int MAX_BLOCK_BYTES = MAX_BLOCK_OPS * 3;
+
+    CPU *cpu;
+    Block **blocks;
+    Recompiler *recompiler;
+    byte codeMap[0x10000 / 8];
+    std::vector<Block *> retired;
+
+    int bankFor(word address) const;
+    bool cacheable(word address) const;
+    Block *compile(word address);
+    int idleLoopCycles(const Block *block) const;
+    void retire(Block *block);
+    void invalidate(word address);
+
+public:
+    BlockCache(CPU *cpu);
+    ~BlockCache();
+
+    Block *find(word address);
+    void execute(Block *block);
+    void flush();
+
+    /* Switches native translation of ROM blocks on or off */
+    bool setRecompiler(bool enabled);
+
+    /* Ends the running block after the current micro-op */
+    void stopBlock();
+
+    /* Called for every memory write, drops blocks covering the address */
+    inline void handleWrite(word address) {
+        word_t a = address.value();
+        if (codeMap[a >> 3] & (1 << (a & 7)))
+            invalidate(address);
+    };
+};
+
+#endif
@@ -0,0 +1,280 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifndef WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#else
+#include <io.h>
+#endif
+
+#include "cartridge.h"
+
+static MBCType mbcForType(byte type)
+{
+    switch (type) {
+    case 0x00: case 0x08: case 0x09:
+        return MBC_NONE;
+    case 0x01: case 0x02: case 0x03:
+        return MBC_1;
+    case 0x0f: case 0x10: case 0x11: case 0x12: case 0x13:
+        return MBC_3;
+    case 0x19: case 0x1a: case 0x1b: case 0x1c: case 0x1d: case 0x1e:
+        return MBC_5;
+    }
+
+    std::cerr << "Unsupported cartridge type " << type << ", ignoring bank switches" << std::endl;
+    return MBC_NONE;
+}
+
+static bool hasBatteryForType(byte type)
+{
+    switch (type) {
+    case 0x03: case 0x09: case 0x0f: case 0x10: case 0x13: case 0x1b: case 0x1e:
+        return true;
+    }
+    return false;
+}
+
+static std::string saveFileName(const char *file)
+{
+    std::string path(file);
+    std::string::size_type slash = path.find_last_of("/\\");
+    std::string::size_type dot = path.find_last_of('.');
+    if (dot != std::string::npos && (slash == std::string::npos || dot > slash))
+        path.erase(dot);
+    return path + ".sav";
+}
+
+static int ramBanksForSize(byte size)
+{
+    static const int banks[6] = { 0, 1, 1, 4, 16, 8 };
+    return size < 6 ? banks[size] : 0;
+}
+
+Cartridge::Cartridge(const char *file)
+    : rom(0), romSize(0), romBanks(0), mapped(false), ram(0), ramBanks(0),
+      battery(false), ramMapped(false), dirty(0), anyDirty(false), mbc(MBC_NONE), ramEnabled(false), romBankRegister(1), bankRegister(0), bankingMode(0)
+{
+    int fd = open(file, O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Cannot open file: " << file << std::endl;
+        exit(1);
+    }
+
+    struct stat st;
+    fstat(fd, &st);
+    romSize = st.st_size;
+    romBanks = (romSize + ROM_BANK_SIZE - 1) / ROM_BANK_SIZE;
+    if (romBanks < 2)
+        romBanks = 2;
+
+#ifndef WIN32
+    // Whole banks can be mapped straight from the file
+    if (romSize == (size_t)romBanks * ROM_BANK_SIZE) {
+        void *p = mmap(0, romSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            rom = (byte *)p;
+            mapped = true;
+        }
+    }
+#endif
+
+    if (!mapped) {
+        // Short images are padded to whole banks
+        rom = new byte[romBanks * ROM_BANK_SIZE];
+        memset(rom, 0, romBanks * ROM_BANK_SIZE);
+        size_t done = 0;
+        while (done < romSize) {
+            int n = read(fd, rom + done, romSize - done);
+            if (n <= 0)
+                break;
+            done += n;
+        }
+    }
+    close(fd);
+
+    mbc = mbcForType(rom[0x147]);
+    ramBanks = ramBanksForSize(rom[0x149]);
+    if (rom[0x147] == 0x08 || rom[0x147] == 0x09)
+        ramEnabled = true;
+
+    battery = hasBatteryForType(rom[0x147]);
+
+    if (ramBanks && battery)
+        mapSaveFile(saveFileName(file));
+
+    if (ramBanks && !ram) {
+        ram = new byte[ramBanks * RAM_BANK_SIZE];
+        memset(ram, 0, ramBanks * RAM_BANK_SIZE);
+    }
+}
+
+void Cartridge::mapSaveFile(const std::string &path)
+{
+#ifndef WIN32
+    size_t size = ramBanks * RAM_BANK_SIZE;
+    int fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        std::cerr << "Cannot open save file: " << path << std::endl;
+        return;
+    }
+
+    // A new or short file reads as zeros
+    struct stat st;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size < size && ftruncate(fd, size) != 0) {
+        std::cerr << "Cannot resize save file: " << path << std::endl;
+        close(fd);
+        return;
+    }
+
+    void *p = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        std::cerr << "Cannot map save file: " << path << std::endl;
+        return;
+    }
+
+    ram = (byte *)p;
+    ramMapped = true;
+    dirty = new byte[size >> 8];
+    memset(dirty, 0, size >> 8);
+#endif
+}
+
+Cartridge::~Cartridge()
+{
+#ifndef WIN32
+    if (mapped)
+        munmap(rom, romSize);
+    else
+#endif
+        delete [] rom;
+
+#ifndef WIN32
+    if (ramMapped) {
+        flush(true);
+        munmap(ram, ramBanks * RAM_BANK_SIZE);
+    } else
+#endif
+        delete [] ram;
+    delete [] dirty;
+}
+
+void Cartridge::markDirty(int bank, int offset)
+{
+    if (dirty) {
+        dirty[(bank * RAM_BANK_SIZE + offset) >> 8] = 1;
+        anyDirty = true;
+    }
+}
+
+bool Cartridge::flush(bool wait)
+{
+    if (!anyDirty)
+        return false;
+
+#ifndef WIN32
+    size_t size = ramBanks * RAM_BANK_SIZE;
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+
+    // Sync runs of dirty system pages
+    size_t start = size;
+    for (size_t offset = 0; offset <= size; offset += 256) {
+        bool isDirty = offset < size && dirty[offset >> 8];
+        if (isDirty && start == size) {
+            start = offset - offset % pageSize;
+        } else if (!isDirty && start != size) {
+            msync(ram + start, offset - start, wait ? MS_SYNC : MS_ASYNC);
+            start = size;
+        }
+    }
+#endif
+
+    memset(dirty, 0, size >> 8);
+    anyDirty = false;
+    return true;
+}
+
+bool Cartridge::write(word address, byte value)
+{
+    word_t a = address.value();
+
+    switch (mbc) {
+    case MBC_NONE:
+        return false;
+
+    case MBC_1:
+        if (a < 0x2000)
+            ramEnabled = (value & 0x0f) == 0x0a;
+        else if (a < 0x4000)
+            romBankRegister = (value & 0x1f) ? (value & 0x1f) : 1;
+        else if (a < 0x6000)
+            bankRegister = value & 0x03;
+        else
+            bankingMode = value & 0x01;
+        return true;
+
+    case MBC_3:
+        if (a < 0x2000)
+            ramEnabled = (value & 0x0f) == 0x0a;
+        else if (a < 0x4000)
+            romBankRegister = (value & 0x7f) ? (value & 0x7f) : 1;
+        else if (a < 0x6000)
+            bankRegister = value;
+        else
+            return false;   // RTC latch
+        return true;
+
+    case MBC_5:
+        if (a < 0x2000)
+            ramEnabled = (value & 0x0f) == 0x0a;
+        else if (a < 0x3000)
+            romBankRegister = (romBankRegister & 0x100) | value;
+        else if (a < 0x4000)
+            romBankRegister = (romBankRegister & 0xff) | ((value & 0x01) << 8);
+        else if (a < 0x6000)
+            bankRegister = value & 0x0f;
+        else
+            return false;
+        return true;
+    }
+
+    return false;
+}
+
+int Cartridge::lowBank() const
+{
+    if (mbc == MBC_1 && bankingMode)
+        return (bankRegister << 5) % romBanks;
+    return 0;
+}
+
+int Cartridge::highBank() const
+{
+    if (mbc == MBC_1)
+        return ((bankRegister << 5) | romBankRegister) % romBanks;
+    return romBankRegister % romBanks;
+}
+
+int Cartridge::ramBank() const
+{
+    if (!ram || !ramEnabled)
+        return -1;
+
+    switch (mbc) {
+    case MBC_1:
+        return bankingMode ? bankRegister % ramBanks : 0;
+    case MBC_3:
+        // RTC registers are not emulated
+        return bankRegister < 0x08 ? bankRegister % ramBanks : -1;
+    case MBC_5:
+        return bankRegister % ramBanks;
+    default:
+        return 0;
+    }
+}
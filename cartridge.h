@@ -0,0 +1,77 @@
+#ifndef CARTRIDGE_H
+#define CARTRIDGE_H
+
+#include <stddef.h>
+#include <string>
+
+#include "word.h"
+
+enum MBCType
+{
+    MBC_NONE  = 0,
+    MBC_1     = 1,
+    MBC_3     = 3,
+    MBC_5     = 5
+};
+
+/*
+ * The ROM image and the memory bank controller of a cartridge. The ROM is
+ * mapped read-only from the file, banking only changes which bank numbers
+ * Memory maps into its page table. Battery backed RAM is a shared mapping
+ * of the .sav file next to the ROM; Memory reports the first write to each
+ * 256 byte page after a flush, so flush() only syncs pages that changed.
+ */
+class Cartridge
+{
+private:
+    static const int ROM_BANK_SIZE = 0x4000;
+    static const int RAM_BANK_SIZE = 0x2000;
+
+    byte *rom;
+    size_t romSize;
+    int romBanks;
+    bool mapped;
+
+    byte *ram;
+    int ramBanks;
+    bool battery;
+    bool ramMapped;
+    byte *dirty;        /* one entry per 256 bytes of RAM */
+    bool anyDirty;
+
+    void mapSaveFile(const std::string &path);
+
+    MBCType mbc;
+    bool ramEnabled;
+    int romBankRegister;
+    byte bankRegister;  /* MBC1 upper bits, MBC3/MBC5 RAM bank or RTC register */
+    byte bankingMode;   /* MBC1 only */
+
+public:
+    Cartridge(const char *file);
+    ~Cartridge();
+
+    MBCType type() const { return mbc; };
+    bool hasBattery() const { return battery && ram; };
+
+    /* Handles a write to the MBC registers, returns true if the mapping changed */
+    bool write(word address, byte value);
+
+    /* Banks mapped to 0x0000-0x3fff, 0x4000-0x7fff and 0xa000-0xbfff */
+    int lowBank() const;
+    int highBank() const;
+    int ramBank() const;   /* -1 if RAM is disabled or absent */
+
+    byte *romData(int bank) const { return rom + bank * ROM_BANK_SIZE; };
+    byte *ramData(int bank) const { return ram + bank * RAM_BANK_SIZE; };
+
+    void markDirty(int bank, int offset);
+    bool isDirty(int bank, int offset) const {
+        return dirty && dirty[(bank * RAM_BANK_SIZE + offset) >> 8];
+    };
+
+    /* Schedules dirty battery RAM for writing, returns false if nothing changed */
+    bool flush(bool wait);
+};
+
+#endif
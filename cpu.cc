@@ -11,13 +11,21 @@
 #include "instructions.h"
 #include "instructionset.h"
 #include "references.h"
-#include "base_instructionset.h"
+#include "opcode_table.h"
+#include "blockcache.h"
+#include "instrumentation.h"
+#ifdef GB_SWITCH_CORE
+#include "opcode_dispatch.h"
+#endif
 
 CPU::CPU(Memory *memory, Debugger *debugger)
     : memory(memory),
       debugger(debugger),
       ime(1),
       cycles(0),
+      idleCycles(0),
+      deadline(~(uint64_t)0),
+      blockStopped(false),
       pc(registerBank[0]), pc_hi(registerBank[0].hiRef()), pc_lo(registerBank[0].loRef()),
       sp(registerBank[1]),
       af(registerBank[2]), a(registerBank[2].hiRef()), f(registerBank[2].loRef()),
@@ -29,6 +37,8 @@ CPU::CPU(Memory *memory, Debugger *debugger)
     pc = 0x100;
     sp = 0xFFFE;
     af = 0x01;
+    flagOp = FLAGS_NONE;
+    haltState = CPU_RUNNING;
 
     b  = 0x00;
     c  = 0x13;
@@ -38,43 +48,120 @@ CPU::CPU(Memory *memory, Debugger *debugger)
     ly = 0x00;
 
     instructionSet = new InstructionSet();
-    initialize_base_instructionset(instructionSet, this);
+    initialize_opcode_table(instructionSet, this);
+
+#ifdef GB_BLOCK_CACHE
+    blockCache = new BlockCache(this);
+    memory->setBlockCache(blockCache);
+#else
+    blockCache = 0;
+#endif
 }
 
 CPU::~CPU()
 {
+    if (blockCache) {
+        memory->setBlockCache(0);
+        delete blockCache;
+    }
     delete instructionSet;
 }
 
 Instruction * CPU::findInstruction(word address)
 {
-    return instructionSet->findInstruction(memory->get<byte>(address));
+    word_t code = memory->get<byte>(address);
+    if (code == 0xcb)
+        code = 0x100 | memory->get<byte>(address + word(1));
+    return instructionSet->findInstruction(code);
+}
+
+Instruction * CPU::decodeInstruction(word_t code)
+{
+    return instructionSet->findInstruction(code);
 }
 
 void CPU::step()
 {
+    if (debugger->isActive())
+        step<DebuggerInstrumentation>();
+    else
+        step<NoInstrumentation>();
+}
+
+template <class Instrumentation>
+void CPU::step()
+{
+    if (haltState != CPU_RUNNING) {
+        if (haltState == CPU_HALT_BUG) {
+            // The byte after HALT is read twice
+            haltState = CPU_RUNNING;
+            execute<Instrumentation>(false);
+            return;
+        }
+        if (!wakeup()) {
+            cycles += 4;
+            return;
+        }
+        haltState = CPU_RUNNING;
+    }
+
     // Check for interrupts...
     byte irqs = IE & IF;
     if (ime && irqs) {
-        if (irqs & (INT_VBLANK+1))
+        if (irqs & (1 << INT_VBLANK))
             callInterrupt(INT_VBLANK,  0x0040);
-        else if (irqs & (INT_LCDSTAT+1))
+        else if (irqs & (1 << INT_LCDSTAT))
             callInterrupt(INT_LCDSTAT, 0x0048);
-        else if (irqs & (INT_TIMER+1))
+        else if (irqs & (1 << INT_TIMER))
             callInterrupt(INT_TIMER,   0x0050);
-        else if (irqs & (INT_SERIAL+1))
+        else if (irqs & (1 << INT_SERIAL))
             callInterrupt(INT_SERIAL,  0x0058);
-        else if (irqs & (INT_JOYPAD+1))
+        else if (irqs & (1 << INT_JOYPAD))
             callInterrupt(INT_JOYPAD,  0x0060);
     }
 
-    // Process command...
-    Instruction * cmd = findInstruction(pc);
-    if (cmd) {
-        debugger->handleInstruction(this, pc);
+    // Run a whole pre-decoded block unless the debugger follows single instructions,
+    // events are handled between blocks so none may be due before the block ends
+    if (Instrumentation::BLOCKS && blockCache) {
+        Block *block = blockCache->find(pc);
+        if (block && cycles + block->cycles <= deadline) {
+            blockCache->execute(block);
+            return;
+        }
+    }
+
+    execute<Instrumentation>(true);
+}
+
+template <class Instrumentation>
+void CPU::execute(bool advance)
+{
+#ifdef GB_SWITCH_CORE
+    byte code = memory->get<byte>(pc);
+    Instrumentation::instruction(this, pc);
+    if (advance)
         pc++;
+    if (!opcode_dispatch(this, code)) {
+        if (advance)
+            pc--;
+        std::cerr << pc << " *** Unknown machine code: " << code << std::endl;
+        debugger->prompt(this);
+    }
+#else
+    word address = pc;
+    word_t code = memory->get<byte>(pc);
+    Instrumentation::instruction(this, pc);
+    if (advance)
+        pc++;
+    if (code == 0xcb) {
+        code = 0x100 | memory->get<byte>(pc);
+        pc++;
+    }
+
+    Instruction * cmd = decodeInstruction(code);
+    if (cmd) {
         if (cmd->condition) {
-            if ((*cmd->condition)(this)) {
+            if (cmd->condition(this)) {
                 cmd->run();
                 cycles += cmd->cycles0;
             } else {
@@ -86,9 +173,11 @@ void CPU::step()
             cycles += cmd->cycles0;
         }
     } else {
+        pc = address;
         std::cerr << pc << " *** Unknown machine code: " << memory->get<byte>(pc) << std::endl;
         debugger->prompt(this);
     }
+#endif
 }
 
 void CPU::callInterrupt(Interrupt irq, word address)
@@ -100,10 +189,7 @@ void CPU::callInterrupt(Interrupt irq, word address)
     ime = 0;
 
     // Push current PC on stack...
-    sp--;
-    memory->set(sp, pc_hi);
-    sp--;
-    memory->set(sp, pc_lo);
+    Stack::push(this, pc);
 
     // Set new PC to interrupt address
     pc = address;
@@ -111,6 +197,47 @@ void CPU::callInterrupt(Interrupt irq, word address)
     debugger->handleInterrupt(irq, address);
 }
 
+void CPU::halt()
+{
+    // With interrupts disabled but already pending HALT ends at once
+    if (!ime && (IE & IF & 0x1f))
+        haltState = CPU_HALT_BUG;
+    else
+        haltState = CPU_HALTED;
+}
+
+void CPU::stop()
+{
+    haltState = CPU_STOPPED;
+}
+
+bool CPU::setRecompiler(bool enabled)
+{
+    if (!blockCache)
+        return !enabled;
+    return blockCache->setRecompiler(enabled);
+}
+
+bool CPU::setBlockCache(bool enabled)
+{
+#ifdef GB_BLOCK_CACHE
+    if (enabled == (blockCache != 0))
+        return true;
+
+    if (enabled) {
+        blockCache = new BlockCache(this);
+        memory->setBlockCache(blockCache);
+    } else {
+        memory->setBlockCache(0);
+        delete blockCache;
+        blockCache = 0;
+    }
+    return true;
+#else
+    return !enabled;
+#endif
+}
+
 void CPU::requestInterrupt(Interrupt irq)
 {
     IF |= (1 << irq);
@@ -9,6 +9,7 @@ class CPU;
 class Debugger;
 class Memory;
 class InstructionSet;
+class BlockCache;
 struct Instruction;
 
 enum Interrupt
@@ -20,20 +21,81 @@ enum Interrupt
     INT_JOYPAD    = 4
 };
 
+/* ALU operations whose flags can be computed from their operands later */
+enum FlagOperation
+{
+    FLAGS_NONE    = 0,
+    FLAGS_ADD     = 1,
+    FLAGS_SUB     = 2,
+    FLAGS_CP      = 3,
+    FLAGS_AND     = 4,
+    FLAGS_OR      = 5,
+    FLAGS_INC     = 6,
+    FLAGS_DEC     = 7
+};
+
+enum HaltState
+{
+    CPU_RUNNING   = 0,
+    CPU_HALTED    = 1,
+    CPU_STOPPED   = 2,
+    CPU_HALT_BUG  = 3   /* next opcode fetch does not advance pc */
+};
+
+enum Register
+{
+    REG_PC = 0,
+    REG_SP = 1,
+    REG_AF = 2,
+    REG_BC = 3,
+    REG_DE = 4,
+    REG_HL = 5
+};
+
 class CPU
 {
 private:
-    word registerBank[6];
     InstructionSet *instructionSet;
+    BlockCache *blockCache;
+    HaltState haltState;
+
+    /* Last ALU operation whose flags are not in f yet */
+    byte flagOp;
+    byte flagA, flagB, flagR;
+
+    static inline byte computeFlags(byte op, byte a, byte b, byte r) {
+        switch (op) {
+        case FLAGS_ADD: return (r == 0 ? 0x80 : 0) | ((r ^ b ^ a) & 0x10 ? 0x20 : 0) | (r < a ? 0x10 : 0);
+        case FLAGS_SUB: return (r == 0 ? 0x80 : 0) | 0x40 | ((r ^ b ^ a) & 0x10 ? 0x20 : 0) | (r < a ? 0x10 : 0);
+        case FLAGS_CP:  return (a == b ? 0x80 : 0) | 0x40 | ((r ^ b ^ a) & 0x10 ? 0x20 : 0) | (a < b ? 0x10 : 0);
+        case FLAGS_AND: return (r == 0 ? 0x80 : 0) | 0x20;
+        case FLAGS_OR:  return (r == 0 ? 0x80 : 0);
+        case FLAGS_INC: return (r == 0 ? 0x80 : 0) | (b & 0x10);   /* b holds the old carry */
+        case FLAGS_DEC: return (r == 0 ? 0x80 : 0) | 0x40 | (b & 0x10);
+        }
+        return 0;
+    };
 
     void callInterrupt(Interrupt irq, word address);
+    template <class Instrumentation> void step();
+    template <class Instrumentation> void execute(bool advance);
+
+    inline bool wakeup() const {
+        if (haltState == CPU_STOPPED)
+            return IF & (1 << INT_JOYPAD);
+        return IE & IF & 0x1f;
+    };
 
 public:
+    word registerBank[6];
     Memory *memory;
     Debugger *debugger;
 
     byte ime; /* interrupt master enable */
-    int cycles;
+    uint64_t cycles; /* since power on, the scheduler's time base */
+    int idleCycles;  /* set when the last block was an idle loop branching back */
+    uint64_t deadline;  /* the next scheduled event, blocks which would run past it are single-stepped */
+    bool blockStopped;  /* set by writes the rest of a running block must not run past */
 
     word &pc; byte &pc_hi; byte &pc_lo;
     word &sp;
@@ -43,29 +105,71 @@ public:
     word &hl; byte &h; byte &l;
     byte &ly; byte &IE; byte &IF;
 
-    inline const byte flagZ() const { return f & (1 << 7); };
-    inline const byte flagN() const { return f & (1 << 6); };
-    inline const byte flagH() const { return f & (1 << 5); };
-    inline const byte flagC() const { return f & (1 << 4); };
+#ifdef GB_LAZY_FLAGS
+    /*
+     * ALU instructions only record their operation and operands, F is
+     * computed when something reads it. Writing f or af directly must be
+     * followed by discardFlags(), reading it preceded by materializeFlags().
+     */
+    inline const byte flags() const {
+        return flagOp ? (f & 0x0f) | computeFlags(flagOp, flagA, flagB, flagR) : f;
+    };
+    inline void materializeFlags() {
+        if (flagOp) {
+            f = flags();
+            flagOp = FLAGS_NONE;
+        }
+    };
+    inline void discardFlags() { flagOp = FLAGS_NONE; };
+    inline void deferFlags(FlagOperation op, byte a, byte b, byte r) {
+        flagOp = op; flagA = a; flagB = b; flagR = r;
+    };
+#else
+    inline const byte flags() const { return f; };
+    inline void materializeFlags() {};
+    inline void discardFlags() {};
+    inline void deferFlags(FlagOperation op, byte a, byte b, byte r) {
+        f = (f & 0x0f) | computeFlags(op, a, b, r);
+    };
+#endif
+
+    inline const byte flagZ() const { return flags() & (1 << 7); };
+    inline const byte flagN() const { return flags() & (1 << 6); };
+    inline const byte flagH() const { return flags() & (1 << 5); };
+    inline const byte flagC() const { return flags() & (1 << 4); };
 
-    inline void flagZ(byte v) { f = v ? (f | (1 << 7)) : (f & ~(1 << 7)); };
-    inline void flagN(byte v) { f = v ? (f | (1 << 6)) : (f & ~(1 << 6)); };
-    inline void flagH(byte v) { f = v ? (f | (1 << 5)) : (f & ~(1 << 5)); };
-    inline void flagC(byte v) { f = v ? (f | (1 << 4)) : (f & ~(1 << 4)); };
+    inline void flagZ(byte v) { materializeFlags(); f = v ? (f | (1 << 7)) : (f & ~(1 << 7)); };
+    inline void flagN(byte v) { materializeFlags(); f = v ? (f | (1 << 6)) : (f & ~(1 << 6)); };
+    inline void flagH(byte v) { materializeFlags(); f = v ? (f | (1 << 5)) : (f & ~(1 << 5)); };
+    inline void flagC(byte v) { materializeFlags(); f = v ? (f | (1 << 4)) : (f & ~(1 << 4)); };
 
     CPU(Memory *memory, Debugger *debugger);
     virtual ~CPU();
 
     void step();
     Instruction *findInstruction(word address);
+    Instruction *decodeInstruction(word_t code);
 
     void requestInterrupt(Interrupt irq);
+
+    void halt();
+    void stop();
+
+    /* True while HALT or STOP waits for an interrupt that is not pending */
+    inline bool isHalted() const {
+        return (haltState == CPU_HALTED || haltState == CPU_STOPPED) && !wakeup();
+    };
+
+    /* Enables the x86-64 recompiler, returns false if it is unavailable */
+    bool setRecompiler(bool enabled);
+
+    /* Switches between pre-decoded blocks and the plain interpreter */
+    bool setBlockCache(bool enabled);
 };
 
-struct Condition { virtual bool operator()(CPU *cpu) const = 0; virtual ~Condition() {}; };
-struct Z_Condition : Condition { virtual bool operator()(CPU *cpu) const { return cpu->flagZ() != 0; }; };
-struct C_Condition : Condition { virtual bool operator()(CPU *cpu) const { return cpu->flagC() != 0; }; };
-struct NZ_Condition : Condition { virtual bool operator()(CPU *cpu) const { return !cpu->flagZ(); }; };
-struct NC_Condition : Condition { virtual bool operator()(CPU *cpu) const { return !cpu->flagC(); }; };
+struct Z_Condition  { static inline bool test(CPU *cpu) { return cpu->flagZ() != 0; }; };
+struct C_Condition  { static inline bool test(CPU *cpu) { return cpu->flagC() != 0; }; };
+struct NZ_Condition { static inline bool test(CPU *cpu) { return !cpu->flagZ(); }; };
+struct NC_Condition { static inline bool test(CPU *cpu) { return !cpu->flagC(); }; };
 
 #endif
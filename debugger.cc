@@ -1,4 +1,5 @@
 #include <algorithm>
+#include <cstring>
 #include <iomanip>
 #include <string>
 
@@ -11,6 +12,7 @@
 #include "debugger.h"
 #include "memory.h"
 #include "instructions.h"
+#include "trace.h"
 
 #ifdef WIN32
 static const bool CONSOLE_COLORS = false;
@@ -23,19 +25,63 @@ static const std::string CONSOLE_GREEN = CONSOLE_COLORS ? "\x1b[32m" : "";
 static const std::string CONSOLE_BLUE  = CONSOLE_COLORS ? "\x1b[34m" : "";
 static const std::string CONSOLE_RESET = CONSOLE_COLORS ? "\x1b[0m"  : "";
 
-Debugger::Debugger() : verboseCPU(false), verboseMemory(false), stepMode(true)
+Debugger::Debugger()
+    : trace(0), traceCycles(0), tracePC(0), verboseCPU(false), verboseMemory(false), stepMode(true),
+      interactive(true), exitOnQuit(true), quitRequested(false)
 {
 }
 
+Debugger::~Debugger()
+{
+    delete trace;
+}
+
+bool Debugger::setTrace(const char *path)
+{
+    delete trace;
+    trace = 0;
+    if (!path)
+        return true;
+
+    trace = new TraceWriter(path);
+    if (!trace->isOpen()) {
+        delete trace;
+        trace = 0;
+        return false;
+    }
+    return true;
+}
+
+void Debugger::traceEvent(byte kind, word address, byte value)
+{
+    TraceRecord r;
+    memset(&r, 0, sizeof(r));
+    r.cycles = traceCycles;
+    r.pc = tracePC;
+    r.kind = kind;
+    r.address = address.value();
+    r.value = value;
+    trace->record(r);
+}
+
+bool AddressMap::testPage(int page) const
+{
+    for (int i = page * 32; i < (page + 1) * 32; ++i)
+        if (bits[i])
+            return true;
+    return false;
+}
+
 void Debugger::toggleBreakpoint(word address)
 {
-    Breakpoints::iterator it = std::find(breakpoints.begin(), breakpoints.end(), address);
-    if(it == breakpoints.end()) {
+    if (!breakpointMap.test(address)) {
         std::cout << "Set breakpoint " << address << std::endl;
         breakpoints.push_back(address);
+        breakpointMap.set(address, true);
     } else {
         std::cout << "Remove breakpoint " << address << std::endl;
-        breakpoints.erase(it);
+        breakpoints.erase(std::find(breakpoints.begin(), breakpoints.end(), address));
+        breakpointMap.set(address, false);
     }
 }
 
@@ -51,18 +97,54 @@ void Debugger::listBreakpoints()
     }
 }
 
-void Debugger::toggleWatch(word address)
+int Debugger::watchConditions(word address) const
+{
+    return (readWatchMap.test(address) ? WATCH_READ : 0) |
+           (writeWatchMap.test(address) ? WATCH_WRITE : 0) |
+           (changeWatchMap.test(address) ? WATCH_CHANGE : 0);
+}
+
+static std::string conditionNames(int conditions)
+{
+    std::string names;
+    if (conditions & WATCH_READ)
+        names += 'r';
+    if (conditions & WATCH_WRITE)
+        names += 'w';
+    if (conditions & WATCH_CHANGE)
+        names += 'c';
+    return names;
+}
+
+void Debugger::toggleWatch(word address, int conditions)
 {
-    Watches::iterator it = std::find(watches.begin(), watches.end(), address);
-    if(it == watches.end()) {
-        std::cout << "Set watch " << address << std::endl;
-        watches.push_back(address);
+    int current = watchConditions(address);
+    if (current == conditions)
+        conditions = 0;
+
+    readWatchMap.set(address, conditions & WATCH_READ);
+    writeWatchMap.set(address, conditions & WATCH_WRITE);
+    changeWatchMap.set(address, conditions & WATCH_CHANGE);
+
+    if (conditions) {
+        std::cout << "Set watch " << address << " " << conditionNames(conditions) << std::endl;
+        if (!current)
+            watches.push_back(address);
     } else {
         std::cout << "Remove watch " << address << std::endl;
-        watches.erase(it);
+        watches.erase(std::find(watches.begin(), watches.end(), address));
     }
 }
 
+bool Debugger::isWatchingPage(int page, bool write) const
+{
+    if (verboseMemory || trace)
+        return true;
+    if (write)
+        return writeWatchMap.testPage(page) || changeWatchMap.testPage(page);
+    return readWatchMap.testPage(page);
+}
+
 void Debugger::listWatches()
 {
     if (watches.empty()) {
@@ -70,17 +152,36 @@ void Debugger::listWatches()
     } else {
         std::cout << "List watches:" << std::endl;
         for (Watches::iterator it = watches.begin(); it != watches.end(); ++it) {
-            std::cout << '\t' << *it << std::endl;
+            std::cout << '\t' << *it << " " << conditionNames(watchConditions(*it)) << std::endl;
         }
     }
 }
 
 void Debugger::handleInstruction(CPU *cpu, word address)
 {
+    if (trace) {
+        cpu->materializeFlags();
+        traceCycles = cpu->cycles;
+        tracePC = address.value();
+
+        TraceRecord r;
+        r.cycles = cpu->cycles;
+        r.pc = address.value();
+        r.af = cpu->af.value();
+        r.bc = cpu->bc.value();
+        r.de = cpu->de.value();
+        r.hl = cpu->hl.value();
+        r.sp = cpu->sp.value();
+        r.address = 0;
+        r.kind = TRACE_INSTRUCTION;
+        r.value = cpu->memory->getRef(address);
+        trace->record(r);
+    }
+
     if (stepMode) {
         printInstruction(cpu, address);
         prompt(cpu);
-    } else if(std::find(breakpoints.begin(), breakpoints.end(), address) != breakpoints.end()) {
+    } else if (breakpointMap.test(address)) {
         std::cout << "Breakpoint at" << std::endl;
         printInstruction(cpu, address);
         prompt(cpu);
@@ -89,28 +190,36 @@ void Debugger::handleInstruction(CPU *cpu, word address)
     }
 }
 
-void Debugger::handleMemoryAccess(Memory *memory, word address, bool set)
+void Debugger::watchRead(word address, byte value)
 {
-    static bool inHandleMemoryAccess = false;
-    if (inHandleMemoryAccess || (!verboseMemory && watches.empty()))
-        return;
+    if (trace)
+        traceEvent(TRACE_READ, address, value);
 
-    inHandleMemoryAccess = true;
-    Watches::iterator it = std::find(watches.begin(), watches.end(), address);
-    if(verboseMemory || (it != watches.end())) {
-        if (set) {
-            std::cout << CONSOLE_RED << " set " << address << " to " 
-                      << memory->get<byte>(address) << CONSOLE_RESET << std::endl;
-        } else {
-            std::cout << CONSOLE_GREEN << " mget " << address << " -> " 
-                      << memory->get<byte>(address) << CONSOLE_RESET << std::endl;
-        }
+    if (verboseMemory || readWatchMap.test(address)) {
+        std::cout << CONSOLE_GREEN << " mget " << address << " -> "
+                  << value << CONSOLE_RESET << std::endl;
+    }
+}
+
+void Debugger::watchWrite(word address, byte old, byte value)
+{
+    if (trace)
+        traceEvent(TRACE_WRITE, address, value);
+
+    if (verboseMemory || writeWatchMap.test(address)) {
+        std::cout << CONSOLE_RED << " set " << address << " to "
+                  << value << CONSOLE_RESET << std::endl;
+    } else if (changeWatchMap.test(address) && old != value) {
+        std::cout << CONSOLE_RED << " change " << address << " from " << old << " to "
+                  << value << CONSOLE_RESET << std::endl;
     }
-    inHandleMemoryAccess = false;
 }
 
 void Debugger::handleInterrupt(int irq, word address)
 {
+    if (trace)
+        traceEvent(TRACE_INTERRUPT, address, irq);
+
     if (!verboseCPU)
         return;
 
@@ -183,18 +292,44 @@ void Debugger::printInstruction(CPU *cpu, word address)
     std::cout << "\t" << address << "\tUnknown instruction: " << cpu->memory->get<byte>(address) << std::endl;
 }
 
+/*
+ * Exiting on the emulator thread would tear down the GameBoy under the
+ * front end, which then has to end the program on its own thread.
+ */
+void Debugger::quit()
+{
+    if (exitOnQuit)
+        exit(0);
+    quitRequested = true;
+}
+
 void Debugger::prompt(CPU *cpu)
 {
     bool done = false;
     char buf[64];
 
+    if (quitRequested)
+        return;
+
+    if (!interactive) {
+        std::cerr << cpu->pc << " *** Stopped, no debugger prompt in batch mode" << std::endl;
+        exit(EXIT_STOPPED);
+    }
+
     while (!done) {
         std::cout << "> " << std::flush;
-        fgets(buf, 64, stdin);
+        if (!fgets(buf, 64, stdin)) {
+            // Nobody left to answer
+            std::cout << std::endl;
+            quit();
+            return;
+        }
         switch (buf[0]) {
         case 'q':
-            exit(0);
+            quit();
+            return;
         case 'r':
+            cpu->materializeFlags();
             std::cout << "\tA: " << cpu->a << "\tF: " << cpu->f << "\tAF: " << cpu->af << std::endl
                       << "\tB: " << cpu->b << "\tC: " << cpu->c << "\tBC: " << cpu->bc << std::endl
                       << "\tD: " << cpu->d << "\tE: " << cpu->e << "\tDE: " << cpu->de << std::endl
@@ -220,8 +355,15 @@ void Debugger::prompt(CPU *cpu)
                 listWatches();
             } else {
                 int v;
-                sscanf(buf, "w %04x", &v);
-                toggleWatch(v);
+                char names[8] = "rw";
+                sscanf(buf, "w %04x %7s", &v, names);
+                int conditions = 0;
+                for (char *c = names; *c; ++c)
+                    conditions |= *c == 'r' ? WATCH_READ : *c == 'w' ? WATCH_WRITE : *c == 'c' ? WATCH_CHANGE : 0;
+                if (conditions) {
+                    toggleWatch(v, conditions);
+                    cpu->memory->updateWatches();
+                }
             }
             break;
         case 'p': {
@@ -251,11 +393,24 @@ void Debugger::prompt(CPU *cpu)
             break;
         case 'u':
             verboseMemory = !verboseMemory;
+            cpu->memory->updateWatches();
             std::cout << "verbose memory = " << verboseMemory << std::endl;
             break;
         case 's':
             showStack(cpu);
             break;
+        case 't':
+            if (trace) {
+                setTrace(0);
+                std::cout << "Trace stopped" << std::endl;
+            } else {
+                char path[64] = "gb.trace";
+                sscanf(buf, "t %63s", path);
+                if (setTrace(path))
+                    std::cout << "Trace to " << path << std::endl;
+            }
+            cpu->memory->updateWatches();
+            break;
         case 'm': {
             int v;
             sscanf(buf, "m %04x", &v);
@@ -273,9 +428,10 @@ void Debugger::prompt(CPU *cpu)
             puts("q - quit");
             puts("r - print registers");
             puts("s - show stack");
+            puts("t - start trace to file (default gb.trace) or stop it");
             puts("u - toggle verbose memory");
             puts("v - toggle verbose cpu");
-            puts("w - list/toggle watch(es)");
+            puts("w - list/toggle watch(es), conditions r, w and c (value change)");
             break;
         }
     }
@@ -1,6 +1,8 @@
 #ifndef DEBUG_H
 #define DEBUG_H
 
+#include <string.h>
+
 #include <vector>
 #include "word.h"
 
@@ -9,26 +11,84 @@ typedef std::vector<word> Watches;
 
 class CPU;
 class Memory;
+class TraceWriter;
+
+enum WatchCondition
+{
+    WATCH_READ   = 1 << 0,
+    WATCH_WRITE  = 1 << 1,
+    WATCH_CHANGE = 1 << 2  /* writes which change the value */
+};
+
+/* One bit per address, so a lookup costs the same for any number of entries */
+struct AddressMap
+{
+    byte bits[0x10000 / 8];
+
+    AddressMap() { memset(bits, 0, sizeof(bits)); };
+    bool test(word address) const {
+        word_t a = address.value();
+        return bits[a >> 3] & (1 << (a & 7));
+    };
+    void set(word address, bool enable) {
+        word_t a = address.value();
+        if (enable)
+            bits[a >> 3] |= (1 << (a & 7));
+        else
+            bits[a >> 3] &= ~(1 << (a & 7));
+    };
+    bool testPage(int page) const;
+};
 
 class Debugger
 {
 private:
-    Breakpoints breakpoints;
+    Breakpoints breakpoints;    /* in the order they were set, for listing */
     Watches watches;
+    AddressMap breakpointMap;
+    AddressMap readWatchMap, writeWatchMap, changeWatchMap;
+
+    /* Memory and interrupt records belong to the last traced instruction */
+    TraceWriter *trace;
+    uint64_t traceCycles;
+    word_t tracePC;
+
+    int watchConditions(word address) const;
+    void traceEvent(byte kind, word address, byte value);
+    void quit();
 
 public:
+    /* Exit status when the program stops where an interactive debugger would prompt */
+    static const int EXIT_STOPPED = 3;
+
     bool verboseCPU, verboseMemory, stepMode;
+    bool interactive;   /* false in batch runs, prompt() then ends the program */
+    bool exitOnQuit;    /* cleared when the CPU runs on another thread than the front end */
+    bool quitRequested; /* set by 'q' or the end of input instead of exiting */
 
     Debugger();
+    ~Debugger();
+
+    /* True if every single instruction has to pass handleInstruction() */
+    bool isActive() const { return stepMode || verboseCPU || trace || !breakpoints.empty(); };
+    bool isWatchingMemory() const { return verboseMemory || trace || !watches.empty(); };
+
+    /* Records every instruction, memory access and interrupt to a file, 0 stops */
+    bool setTrace(const char *path);
 
     void handleInstruction(CPU *cpu, word address);
-    void handleMemoryAccess(Memory *memory, word address, bool set);
+    bool isWatchingPage(int page, bool write) const;
+
+    /* Called by Memory for accesses to pages with watches */
+    void watchRead(word address, byte value);
+    void watchWrite(word address, byte old, byte value);
     void handleInterrupt(int irq, word address);
 
     void toggleBreakpoint(word address);
     void listBreakpoints();
 
-    void toggleWatch(word address);
+    /* Sets the watch conditions of an address, or removes them if they are already set */
+    void toggleWatch(word address, int conditions);
     void listWatches();
 
     void showMemory(CPU *cpu, word address);
@@ -0,0 +1,83 @@
+#include <cstring>
+
+#include "emulatorthread.h"
+#include "debugger.h"
+
+EmulatorThread::EmulatorThread(GameBoy *gb)
+    : gb(gb), running(false), quitRequested(false), buttons(0), breakRequested(false), verboseToggled(false),
+      turbo(false), statsUpdated(false), fps(0), speed(0)
+{
+    gb->getDebugger()->exitOnQuit = false;
+}
+
+EmulatorThread::~EmulatorThread()
+{
+    stop();
+}
+
+void EmulatorThread::start()
+{
+    running = true;
+    thread = std::thread(&EmulatorThread::run, this);
+}
+
+void EmulatorThread::stop()
+{
+    running = false;
+    if (thread.joinable())
+        thread.join();
+}
+
+void EmulatorThread::setButton(Button btn, bool pressed)
+{
+    if (pressed)
+        buttons.fetch_or(btn);
+    else
+        buttons.fetch_and(~btn);
+}
+
+/* Hands what the front end asked for to the GameBoy, on this thread */
+void EmulatorThread::applyRequests(byte &applied, FramePacer &pacer)
+{
+    byte current = buttons.load();
+    for (int bit = 0; bit < 8; ++bit) {
+        byte btn = 1 << bit;
+        if ((current ^ applied) & btn)
+            gb->setButton((Button)btn, current & btn);
+    }
+    applied = current;
+
+    Debugger *debugger = gb->getDebugger();
+    if (breakRequested.exchange(false))
+        debugger->stepMode = true;
+    if (verboseToggled.exchange(false))
+        debugger->verboseCPU = !debugger->verboseCPU;
+    if (turbo != pacer.isTurbo())
+        pacer.setTurbo(turbo);
+}
+
+void EmulatorThread::run()
+{
+    byte applied = 0;
+    FramePacer pacer;
+    Debugger *debugger = gb->getDebugger();
+
+    while (running) {
+        applyRequests(applied, pacer);
+        while (!gb->process()) {
+            if (debugger->quitRequested) {
+                quitRequested = true;
+                return;
+            }
+        }
+
+        memcpy(frames.writeBuffer().shades, gb->getScreen(), sizeof(Frame::shades));
+        frames.publish();
+
+        if (pacer.frameDone()) {
+            fps = pacer.getFPS();
+            speed = pacer.getSpeed();
+            statsUpdated = true;
+        }
+    }
+}
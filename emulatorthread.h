@@ -0,0 +1,77 @@
+#ifndef EMULATORTHREAD_H
+#define EMULATORTHREAD_H
+
+#include <atomic>
+#include <thread>
+
+#include "framepacer.h"
+#include "gameboy.h"
+#include "triplebuffer.h"
+
+struct Frame
+{
+    byte shades[GB_DISPLAY_WIDTH * GB_DISPLAY_HEIGHT];
+};
+
+/*
+ * Runs a GameBoy on its own thread at the rate of the real LCD. Only this
+ * thread touches the GameBoy while it runs; the front end talks to it
+ * through atomics and takes finished frames from a triple buffer. The
+ * thread never exits the program, quitting the debugger only stops it.
+ */
+class EmulatorThread
+{
+private:
+    GameBoy *gb;
+    std::thread thread;
+    std::atomic<bool> running;
+    std::atomic<bool> quitRequested;
+    std::atomic<unsigned> buttons;
+    std::atomic<bool> breakRequested;
+    std::atomic<bool> verboseToggled;
+    std::atomic<bool> turbo;
+    std::atomic<bool> statsUpdated;
+    std::atomic<double> fps;
+    std::atomic<double> speed;
+    TripleBuffer<Frame> frames;
+
+    void run();
+    void applyRequests(byte &applied, FramePacer &pacer);
+
+public:
+    EmulatorThread(GameBoy *gb);
+    ~EmulatorThread();
+
+    void start();
+    void stop();
+
+    /* The debugger was told to quit, the front end ends the program on its own thread */
+    bool isQuitRequested() const { return quitRequested; };
+
+    void setButton(Button btn, bool pressed);
+    void requestBreak() { breakRequested = true; };
+    void toggleVerbose() { verboseToggled = true; };
+
+    /* Runs frames as fast as the host allows instead of at the LCD rate */
+    bool isTurbo() const { return turbo; };
+    void setTurbo(bool enabled) { turbo = enabled; };
+
+    /* Fetches the frame rate and speed multiplier once per interval */
+    bool takeStats(double &framesPerSecond, double &speedMultiplier) {
+        if (!statsUpdated.exchange(false))
+            return false;
+        framesPerSecond = fps;
+        speedMultiplier = speed;
+        return true;
+    };
+
+    bool hasFrame() const { return frames.hasUpdate(); };
+
+    /* The latest complete frame, see shadesToRGB() */
+    const byte *latestFrame() {
+        frames.update();
+        return frames.readBuffer().shades;
+    };
+};
+
+#endif
@@ -0,0 +1,91 @@
+#if defined(WIN32) || defined(__APPLE__)
+#include <chrono>
+#include <thread>
+#else
+#include <errno.h>
+#include <time.h>
+#endif
+
+#include "framepacer.h"
+
+FramePacer::FramePacer() : turbo(false), statsFrames(0), fps(0)
+{
+    restart(now());
+    statsStart = deadline;
+}
+
+void FramePacer::restart(int64_t now)
+{
+    deadline = now;
+    remainder = 0;
+}
+
+void FramePacer::setTurbo(bool enabled)
+{
+    if (turbo && !enabled)
+        restart(now());
+    turbo = enabled;
+}
+
+bool FramePacer::frameDone()
+{
+    if (!turbo) {
+        deadline += FRAME_NS;
+        remainder += FRAME_NS_REMAINDER;
+        if (remainder >= 4194304) {
+            remainder -= 4194304;
+            ++deadline;
+        }
+
+        int64_t current = now();
+        if (current - deadline > MAX_LAG)
+            restart(current);
+        else if (deadline > current)
+            sleepUntil(deadline);
+    }
+
+    ++statsFrames;
+    int64_t current = now();
+    if (current - statsStart < STATS_INTERVAL)
+        return false;
+
+    fps = statsFrames * 1e9 / (current - statsStart);
+    statsStart = current;
+    statsFrames = 0;
+    return true;
+}
+
+#if defined(WIN32) || defined(__APPLE__)
+
+int64_t FramePacer::now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void FramePacer::sleepUntil(int64_t when)
+{
+    std::chrono::nanoseconds since(when);
+    std::this_thread::sleep_until(std::chrono::steady_clock::time_point(
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(since)));
+}
+
+#else
+
+int64_t FramePacer::now()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * (int64_t)1000000000 + ts.tv_nsec;
+}
+
+void FramePacer::sleepUntil(int64_t when)
+{
+    timespec ts;
+    ts.tv_sec = when / 1000000000;
+    ts.tv_nsec = when % 1000000000;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, 0) == EINTR)
+        ;
+}
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef FRAMEPACER_H
+#define FRAMEPACER_H
+
+#include <stdint.h>
+
+/* 4194304 Hz / 70224 cycles per frame */
+#define GB_FRAME_RATE 59.7275005696
+
+/*
+ * Holds a thread to the refresh rate of the real LCD. Deadlines are absolute
+ * and advance by exactly one frame, so sleeping late does not accumulate
+ * drift; when the host falls too far behind, the schedule restarts from now
+ * instead of running a burst of frames to catch up. In turbo mode frames are
+ * not held back at all.
+ */
+class FramePacer
+{
+private:
+    static const int64_t FRAME_NS = 16742706;           /* 70224e9 / 4194304, rounded down */
+    static const int64_t FRAME_NS_REMAINDER = 1253376;  /* what was rounded away, in 1/4194304 ns */
+    static const int64_t MAX_LAG = 4 * FRAME_NS;
+    static const int64_t STATS_INTERVAL = 1000000000;
+
+    bool turbo;
+    int64_t deadline;
+    int64_t remainder;
+
+    int64_t statsStart;
+    int statsFrames;
+    double fps;
+
+    void restart(int64_t now);
+
+public:
+    FramePacer();
+
+    bool isTurbo() const { return turbo; };
+    void setTurbo(bool enabled);
+
+    /* Call once per emulated frame, returns true when new stats are available */
+    bool frameDone();
+
+    /* Frames per second over the last interval */
+    double getFPS() const { return fps; };
+    /* Emulation speed relative to the real hardware */
+    double getSpeed() const { return fps / GB_FRAME_RATE; };
+
+    /* Nanoseconds on the monotonic clock */
+    static int64_t now();
+    static void sleepUntil(int64_t when);
+};
+
+#endif
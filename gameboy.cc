@@ -1,143 +1,258 @@
+#include <cstring>
 #include <iostream>
 
 #include "gameboy.h"
 #include "cpu.h"
 #include "memory.h"
+#include "ppu.h"
 #include "debugger.h"
+#include "scheduler.h"
 
-static byte colors[4][3] = {
-    {196, 207, 161},
-    {139, 149, 109},
-    { 77,  83,  60},
-    { 31,  31,  31},
-};
+/* Durations in CPU cycles */
+static const int CYCLES_DMA      = 640;
+static const int CYCLES_SERIAL   = 4096;   /* 8 bits at 8192 Hz */
 
-GameBoy::GameBoy(const char *file) : buttons(0)
+static const int timerPeriods[4] = { 1024, 16, 64, 256 };
+
+GameBoy::GameBoy(const char *file) : buttons(0), idleSkip(true)
 {
-    memset(screen, 0, GB_DISPLAY_WIDTH * GB_DISPLAY_HEIGHT * 3);
     debugger = new Debugger();
     memory = new Memory(file, debugger);
     cpu = new CPU(memory, debugger);
+    scheduler = new Scheduler();
+    ppu = new PPU(memory, cpu, scheduler);
+
+    divBase = 0;
+    timaBase = 0;
+    timaValue = 0;
+    tac = 0;
+    dmaSource = 0;
+
+    memory->setIOHandler(this);
+    updateJoypad();
 }
 
 GameBoy::~GameBoy()
 {
+    delete ppu;
     delete debugger;
     delete cpu;
     delete memory;
+    delete scheduler;
 }
 
 void GameBoy::setButton(Button btn, bool pressed)
 {
+    byte old = buttons;
     buttons = pressed ? (buttons | btn) : (buttons & ~btn);
+    updateJoypad();
+
+    if (buttons & ~old)
+        cpu->requestInterrupt(INT_JOYPAD);
 }
 
-void GameBoy::set_pixel(int x, int y, int color)
+void GameBoy::updateJoypad()
 {
-    if (x < 0 || x >= GB_DISPLAY_WIDTH || y < 0 || y >= GB_DISPLAY_HEIGHT || color > 3)
-        return;
-    screen[((y * GB_DISPLAY_WIDTH + x) * 3) + 0] = colors[color][0];
-    screen[((y * GB_DISPLAY_WIDTH + x) * 3) + 1] = colors[color][1];
-    screen[((y * GB_DISPLAY_WIDTH + x) * 3) + 2] = colors[color][2];
-}
-
-void GameBoy::fillScreen()
-{
-    memset(screen, 0, GB_DISPLAY_WIDTH * GB_DISPLAY_HEIGHT * 3);
-
-    // Draw background
-    for (int row = 0; row < 32; row++) {
-        for (int col = 0; col < 32; col++) {
-            byte tile = memory->get<byte>(0x9800 + (row * 32) + col);
-
-            for (int y = 0; y < 8; y++) {
-                int address = 0x8000 + (tile * 16) + (y * 2);
-                byte byte1 = memory->get<byte>(address);
-                byte byte2 = memory->get<byte>(address + 1);
-
-                for (int x = 0; x < 8; x++) {
-                    int i;
-                    if (x == 0)
-                        i = (byte1 & 1) + ((byte2 & 1) << 1);
-                    else
-                        i = ((byte1 & (1 << x)) >> (x))
-                          + ((byte2 & (1 << x)) >> (x-1));
-                    set_pixel((col * 8) + 7 - x, (row * 8) + y, i);
-                }
-            }
-        }
+    byte &b = memory->getRef(0xff00);
+    if (~b & (1 << 5)) {
+        b = (b & 0xf0) | (0x0f & ~(0x0f & (buttons >> 4)));
+    } else if (~b & (1 << 4)) {
+        b = (b & 0xf0) | (0x0f & ~(0x0f & buttons));
+    } else {
+        b |= 0x0f;
     }
+}
 
-    // Draw sprites
-    for (word sprite = 0xfe00; sprite <= 0xfe9f; sprite += 4) {
-        byte ypos = memory->get<byte>(sprite);
+bool GameBoy::setRecompiler(bool enabled)
+{
+    return cpu->setRecompiler(enabled);
+}
 
-        // Sprite hidden via ypos?
-        if (ypos == 0 || ypos >= 160)
-            continue;
+bool GameBoy::setBlockCache(bool enabled)
+{
+    return cpu->setBlockCache(enabled);
+}
 
-        byte xpos = memory->get<byte>(sprite+word(1));
+bool GameBoy::setTrace(const char *path)
+{
+    bool ok = debugger->setTrace(path);
+    memory->updateWatches();
+    return ok;
+}
 
-        // Sprite hidden via xpos?
-        if (xpos == 0 || xpos >= 168)
-            continue;
+int GameBoy::timerPeriod() const
+{
+    return timerPeriods[tac & 0x03];
+}
 
-        //TODO: Ordering priority
+byte GameBoy::timerValue(uint64_t now) const
+{
+    if (!(tac & 0x04) || now <= timaBase)
+        return timaValue;
 
-        byte tile = memory->get<byte>(sprite+word(2));
-        //byte attr = memory->get<byte>(sprite+word(3));
+    // TIMA counts falling edges of a DIV counter bit
+    uint64_t period = timerPeriod();
+    uint64_t v = timaValue + (now - divBase) / period - (timaBase - divBase) / period;
+    if (v > 0xff) {
+        // The overflow event is due but has not been handled yet
+        v = memory->getRef(0xff06) + (v - 0x100);
+    }
+    return v;
+}
 
-        for (int y = 0; y < 8; y++) {
-            int address = 0x8000 + (tile * 16) + (y * 2);
-            byte byte1 = memory->get<byte>(address);
-            byte byte2 = memory->get<byte>(address + 1);
+void GameBoy::syncTimer(uint64_t now)
+{
+    if ((tac & 0x04) && now > timaBase) {
+        uint64_t period = timerPeriod();
+        uint64_t v = timaValue + (now - divBase) / period - (timaBase - divBase) / period;
+        if (v > 0xff) {
+            v = memory->getRef(0xff06) + (v - 0x100);
+            cpu->requestInterrupt(INT_TIMER);
+        }
+        timaValue = v;
+    }
+    timaBase = now;
+}
 
-            for (int x = 0; x < 8; x++) {
-                int i;
-                if (x == 0)
-                    i = (byte1 & 1) + ((byte2 & 1) << 1);
-                else
-                    i = ((byte1 & (1 << x)) >> (x))
-                      + ((byte2 & (1 << x)) >> (x-1));
-                set_pixel((xpos - 8) + 7 - x, (ypos - 16) + y, i);
-            }
+void GameBoy::scheduleTimer()
+{
+    if (!(tac & 0x04)) {
+        scheduler->cancel(EVENT_TIMER);
+        return;
+    }
+
+    uint64_t period = timerPeriod();
+    uint64_t ticks = (timaBase - divBase) / period + (0x100 - timaValue);
+    scheduler->schedule(EVENT_TIMER, divBase + ticks * period);
+}
+
+void GameBoy::timerEvent(uint64_t when)
+{
+    syncTimer(when);
+    scheduleTimer();
+}
+
+byte GameBoy::peek(word address)
+{
+    word_t a = address.value();
+    if (a >= 0xe000 && a < 0xfe00)
+        a -= 0x2000;
+    if (a >= 0xff00 && a < 0xff80)
+        return readIO(a);
+    return memory->getRef(a);
+}
+
+byte GameBoy::readIO(word address)
+{
+    switch (address.value()) {
+    case 0xff04:
+        return (cpu->cycles - divBase) >> 8;
+    case 0xff05:
+        return timerValue(cpu->cycles);
+    default:
+        return memory->getRef(address);
+    }
+}
+
+void GameBoy::writeIO(word address, byte value)
+{
+    uint64_t now = cpu->cycles;
+
+    switch (address.value()) {
+    case 0xff00:
+        updateJoypad();
+        break;
+    case 0xff02:
+        if ((value & 0x81) == 0x81) {
+            if (serialLog.size() >= SERIAL_LOG_SIZE)
+                serialLog.erase(0, SERIAL_LOG_SIZE / 2);
+            serialLog += (char)memory->getRef(0xff01);
+            scheduler->schedule(EVENT_SERIAL, now + CYCLES_SERIAL);
         }
+        break;
+    case 0xff04:
+        syncTimer(now);
+        divBase = now;
+        timaBase = now;
+        memory->getRef(address) = 0;
+        scheduleTimer();
+        break;
+    case 0xff05:
+        timaValue = value;
+        timaBase = now;
+        scheduleTimer();
+        break;
+    case 0xff07:
+        syncTimer(now);
+        tac = value;
+        scheduleTimer();
+        break;
+    case 0xff40:
+    case 0xff41:
+    case 0xff44:
+    case 0xff45:
+        ppu->writeRegister(address, value, now);
+        break;
+    case 0xff46:
+        dmaSource = value;
+        scheduler->schedule(EVENT_DMA, now + CYCLES_DMA);
+        break;
     }
 }
 
 bool GameBoy::process()
 {
-    int oldCycles = cpu->cycles;
-    while ((cpu->cycles - oldCycles) < 270) {
-        // write joypad data
-        byte b = memory->get<byte>(0xff00);
-        if (~b & (1 << 5)) {
-            b = (b & 0xf0) | (0x0f & ~(0x0f & (buttons >> 4)));
-        } else if (~b & (1 << 4)) {
-            b = (b & 0xf0) | (0x0f & ~(0x0f & buttons));
-        } else {
-            b |= 0x0f;
+    while (cpu->cycles < scheduler->nextDeadline()) {
+        if (cpu->isHalted()) {
+            // Only an event can wake the CPU up
+            cpu->cycles = scheduler->nextDeadline();
+            break;
         }
-        memory->set<byte>(0xff00, b);
+        cpu->deadline = scheduler->nextDeadline();
+        cpu->step();
 
-        // increment DIV register
-        // TODO: timing? This register is incremented 16384 (~16779 on SGB) times a second.
-        memory->set<byte>(0xff04, memory->get<byte>(0xff04)+1);
+        // The front end ends the program, nothing more to run
+        if (debugger->quitRequested)
+            return false;
 
-        cpu->step();
+        if (cpu->idleCycles) {
+            // Every further iteration polls the same values until the next event
+            uint64_t deadline = scheduler->nextDeadline();
+            if (idleSkip && cpu->cycles < deadline) {
+                uint64_t iterations = (deadline - cpu->cycles + cpu->idleCycles - 1) / cpu->idleCycles;
+                cpu->cycles += iterations * cpu->idleCycles;
+            }
+            cpu->idleCycles = 0;
+        }
     }
 
-    cpu->ly += 1;
-    if (cpu->ly > 153) {
-        cpu->ly = 0;
-    } else if (cpu->ly == 144) {
-        /* vblank interrupt */
-        cpu->requestInterrupt(INT_VBLANK);
-        fillScreen();
-        cpu->cycles = 0;
-
-        return true;
+    bool frame = false;
+    uint64_t when;
+    Event event;
+    while ((event = scheduler->pop(cpu->cycles, when)) != EVENT_NONE) {
+        switch (event) {
+        case EVENT_LCD:
+            frame |= ppu->event(when);
+            break;
+        case EVENT_TIMER:
+            timerEvent(when);
+            break;
+        case EVENT_SERIAL:
+            // No link partner, the other side shifts in ones
+            memory->getRef(0xff01) = 0xff;
+            memory->getRef(0xff02) &= ~0x80;
+            cpu->requestInterrupt(INT_SERIAL);
+            break;
+        case EVENT_DMA:
+            memory->dmaTransfer(dmaSource);
+            break;
+        default:
+            break;
+        }
     }
 
-    return false;
+    if (frame)
+        memory->flushSaveRam();
+
+    return frame;
 }
@@ -1,10 +1,11 @@
 #ifndef GAMEBOY_H
 #define GAMEBOY_H
 
-#include "word.h"
+#include <string>
 
-const byte GB_DISPLAY_WIDTH  = 160;
-const byte GB_DISPLAY_HEIGHT = 144;
+#include "word.h"
+#include "memory.h"
+#include "ppu.h"
 
 enum Button
 {
@@ -18,32 +19,72 @@ enum Button
     BTN_START  = 1 << 7
 };
 
-class Memory;
 class CPU;
 class Debugger;
+class PPU;
+class Scheduler;
 
-class GameBoy
+class GameBoy : public IOHandler
 {
 private:
     byte buttons;
-    byte screen[GB_DISPLAY_WIDTH * GB_DISPLAY_HEIGHT * 3];
     Debugger *debugger;
     Memory *memory;
     CPU *cpu;
+    Scheduler *scheduler;
+    PPU *ppu;
+
+    /* DIV and TIMA are derived from the cycle counter when read */
+    uint64_t divBase;
+    uint64_t timaBase;
+    byte timaValue;
+    byte tac;
+
+    byte dmaSource;
+    bool idleSkip;
+
+    /* Bytes shifted out over the link port, the most recent SERIAL_LOG_SIZE */
+    std::string serialLog;
 
-    void set_pixel(int x, int y, int color);
-    void fillScreen();
+    void updateJoypad();
+
+    int timerPeriod() const;
+    byte timerValue(uint64_t now) const;
+    void syncTimer(uint64_t now);
+    void scheduleTimer();
+    void timerEvent(uint64_t when);
 public:
+    static const size_t SERIAL_LOG_SIZE = 4096;
 
     GameBoy(const char *file);
     virtual ~GameBoy();
 
+    /*
+     * Runs the CPU up to the next event, returns true when a frame is
+     * complete. Returns false at once after the debugger was told to quit.
+     */
     bool process();
     void setButton(Button btn, bool pressed);
+    bool setRecompiler(bool enabled);
+    bool setBlockCache(bool enabled);
+    bool setTrace(const char *path);
+
+    /* Fast-forwards loops polling for the next event, on by default */
+    void setIdleSkip(bool enabled) { idleSkip = enabled; }
 
-    const byte *getScreen() const { return screen; }
+    /* The last frame as shade indices, see shadesToRGB() */
+    const byte *getScreen() const { return ppu->getScreen(); }
 
     Debugger *getDebugger() { return debugger; }
+
+    /* What the game sent over the link port, test ROMs report results there */
+    const std::string &getSerialOutput() const { return serialLog; }
+
+    /* Reads memory as the CPU would, without the debugger's watches or trace seeing it */
+    byte peek(word address);
+
+    byte readIO(word address);
+    void writeIO(word address, byte value);
 };
 
 #endif
@@ -0,0 +1,243 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+#include <zlib.h>
+
+#include "gameboy.h"
+#include "debugger.h"
+#include "framepacer.h"
+
+static const int PIXELS = GB_DISPLAY_WIDTH * GB_DISPLAY_HEIGHT;
+
+/* When to stop before the frame limit, checked after every frame */
+struct Condition
+{
+    enum { NONE, SERIAL, MEMORY } kind;
+    std::string text;
+    word_t address;
+    byte value;
+};
+
+static bool parseCondition(const char *arg, Condition &cond)
+{
+    if (strncmp(arg, "serial:", 7) == 0) {
+        cond.kind = Condition::SERIAL;
+        cond.text = arg + 7;
+        return !cond.text.empty();
+    }
+
+    unsigned address, value;
+    char end;
+    if (sscanf(arg, "%x=%x%c", &address, &value, &end) != 2 || address > 0xffff || value > 0xff)
+        return false;
+    cond.kind = Condition::MEMORY;
+    cond.address = address;
+    cond.value = value;
+    return true;
+}
+
+static bool conditionMet(GameBoy *gb, const Condition &cond)
+{
+    switch (cond.kind) {
+    case Condition::SERIAL:
+        return gb->getSerialOutput().find(cond.text) != std::string::npos;
+    case Condition::MEMORY:
+        return gb->peek(cond.address) == cond.value;
+    default:
+        return false;
+    }
+}
+
+/* FNV-1a over the shade indices, independent of the palette used to show them */
+static uint64_t hashScreen(const byte *shades)
+{
+    uint64_t hash = 1469598103934665603ULL;
+    for (int i = 0; i < PIXELS; ++i)
+        hash = (hash ^ shades[i]) * 1099511628211ULL;
+    return hash;
+}
+
+static void putBE32(std::vector<byte> &out, uint32_t value)
+{
+    out.push_back(value >> 24);
+    out.push_back(value >> 16);
+    out.push_back(value >> 8);
+    out.push_back(value);
+}
+
+static void putChunk(std::vector<byte> &out, const char *type, const byte *data, uint32_t size)
+{
+    putBE32(out, size);
+    size_t start = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data, data + size);
+    putBE32(out, crc32(0, &out[start], size + 4));
+}
+
+static bool writePNG(FILE *fp, const byte *rgb)
+{
+    static const byte signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    const int stride = GB_DISPLAY_WIDTH * 3;
+
+    // Every row starts with filter type 0, no filtering
+    std::vector<byte> raw;
+    for (int y = 0; y < GB_DISPLAY_HEIGHT; ++y) {
+        raw.push_back(0);
+        raw.insert(raw.end(), rgb + y * stride, rgb + (y + 1) * stride);
+    }
+    uLongf packedSize = compressBound(raw.size());
+    std::vector<byte> packed(packedSize);
+    if (compress2(&packed[0], &packedSize, &raw[0], raw.size(), Z_BEST_COMPRESSION) != Z_OK)
+        return false;
+
+    std::vector<byte> header;
+    putBE32(header, GB_DISPLAY_WIDTH);
+    putBE32(header, GB_DISPLAY_HEIGHT);
+    header.push_back(8);    // bit depth
+    header.push_back(2);    // truecolor
+    header.push_back(0);    // deflate
+    header.push_back(0);    // adaptive filtering
+    header.push_back(0);    // not interlaced
+
+    std::vector<byte> out(signature, signature + sizeof(signature));
+    putChunk(out, "IHDR", &header[0], header.size());
+    putChunk(out, "IDAT", &packed[0], packedSize);
+    putChunk(out, "IEND", 0, 0);
+    return fwrite(&out[0], 1, out.size(), fp) == out.size();
+}
+
+static bool writePPM(FILE *fp, const byte *rgb)
+{
+    fprintf(fp, "P6\n%d %d\n255\n", GB_DISPLAY_WIDTH, GB_DISPLAY_HEIGHT);
+    return fwrite(rgb, 3, PIXELS, fp) == (size_t)PIXELS;
+}
+
+/* Writes PNG unless the name ends in .ppm */
+static bool writeScreen(const char *path, const byte *shades)
+{
+    static byte rgb[PIXELS * 3];
+    shadesToRGB(shades, rgb, PIXELS);
+
+    FILE *fp = fopen(path, "wb");
+    if (!fp) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        return false;
+    }
+    size_t length = strlen(path);
+    bool ppm = length > 4 && strcasecmp(path + length - 4, ".ppm") == 0;
+    bool ok = ppm ? writePPM(fp, rgb) : writePNG(fp, rgb);
+    if (fclose(fp) != 0 || !ok) {
+        fprintf(stderr, "Cannot write %s\n", path);
+        return false;
+    }
+    return true;
+}
+
+static GameBoy *gb = 0;
+
+/* Also runs when the debugger ends the program, so traces and saves are complete */
+static void cleanup()
+{
+    delete gb;
+    gb = 0;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "Usage: %s [-n frames] [-u condition] [-o image] [-j] [-i] [-r] [-t trace] rom\n"
+            "  -n frames     stop after this many frames (default 3600)\n"
+            "  -u condition  stop early when serial:TEXT was sent over the link port,\n"
+            "                or when ADDR=VALUE holds in memory (hex)\n"
+            "  -o image      write the last frame, PPM for names ending in .ppm, else PNG\n"
+            "  -j            use the recompiler\n"
+            "  -i            run idle loops instead of skipping to the next event\n"
+            "  -r            run at the speed of the real hardware\n"
+            "  -t trace      record an execution trace\n"
+            "Exits with 1 if the condition was not met, 3 if the ROM hit an unknown opcode\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+    long frameLimit = 3600;
+    Condition cond;
+    cond.kind = Condition::NONE;
+    const char *image = 0;
+    const char *trace = 0;
+    bool recompiler = false;
+    bool idleSkip = true;
+    bool realtime = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:u:o:jirt:")) != -1) {
+        switch (opt) {
+        case 'n':
+            frameLimit = strtol(optarg, 0, 0);
+            if (frameLimit <= 0) {
+                fprintf(stderr, "Invalid frame count: %s\n", optarg);
+                return 2;
+            }
+            break;
+        case 'u':
+            if (!parseCondition(optarg, cond)) {
+                fprintf(stderr, "Invalid condition: %s\n", optarg);
+                return 2;
+            }
+            break;
+        case 'o': image = optarg; break;
+        case 'j': recompiler = true; break;
+        case 'i': idleSkip = false; break;
+        case 'r': realtime = true; break;
+        case 't': trace = optarg; break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    gb = new GameBoy(argv[optind]);
+    atexit(cleanup);
+    gb->getDebugger()->stepMode = false;
+    gb->getDebugger()->interactive = false;
+    gb->setIdleSkip(idleSkip);
+    if (recompiler && !gb->setRecompiler(true))
+        fprintf(stderr, "Recompiler not available, using the interpreter\n");
+    if (trace && !gb->setTrace(trace))
+        return 1;
+
+    FramePacer pacer;
+    pacer.setTurbo(!realtime);
+
+    int64_t start = FramePacer::now();
+    long frames = 0;
+    bool met = false;
+    while (frames < frameLimit && !met) {
+        while (!gb->process())
+            ;
+        ++frames;
+        pacer.frameDone();
+        met = conditionMet(gb, cond);
+    }
+    double elapsed = (FramePacer::now() - start) / 1e9;
+    double emulated = frames / GB_FRAME_RATE;
+
+    printf("frames   %ld (%s)\n", frames, met ? "condition met" : "frame limit");
+    printf("time     %.3f s emulated, %.3f s elapsed\n", emulated, elapsed);
+    printf("speed    %.1f fps, %.2fx\n", frames / elapsed, emulated / elapsed);
+    printf("screen   %016llx\n", (unsigned long long)hashScreen(gb->getScreen()));
+    if (!gb->getSerialOutput().empty())
+        printf("serial   %s\n", gb->getSerialOutput().c_str());
+
+    bool ok = !image || writeScreen(image, gb->getScreen());
+    if (!ok)
+        return 1;
+    return cond.kind != Condition::NONE && !met ? 1 : 0;
+}
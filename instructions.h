@@ -14,25 +14,7 @@ struct flags {
     bool c;
 };
 
-static byte addByte(const byte &a, const byte &b, flags &f)
-{
-    byte r = a + b;
-    f.z = r == 0;
-    f.h = (r ^ b ^ a) & 0x10;
-    f.c = r < a;
-    return r;
-}
-
-static byte subByte(const byte &a, const byte &b, flags &f)
-{
-    byte r = a - b;
-    f.z = r == 0;
-    f.h = (r ^ b ^ a) & 0x10;
-    f.c = r < a;
-    return r;
-}
-
-static word addSignedByte(const word &a, const byte &b, flags &f)
+static inline word addSignedByte(const word &a, const byte &b, flags &f)
 {
     signed_byte sb = (signed_byte)b;
     word r = a + sb;
@@ -42,7 +24,7 @@ static word addSignedByte(const word &a, const byte &b, flags &f)
     return r;
 }
 
-static word addWord(const word &a, const word &b, flags &f)
+static inline word addWord(const word &a, const word &b, flags &f)
 {
     word r = a + b;
     f.z = r == 0;
@@ -51,7 +33,7 @@ static word addWord(const word &a, const word &b, flags &f)
     return r;
 }
 
-static word subWord(const word &a, const word &b, flags &f)
+static inline word subWord(const word &a, const word &b, flags &f)
 {
     word r = a - b;
     f.z = r == 0;
@@ -62,85 +44,87 @@ static word subWord(const word &a, const word &b, flags &f)
 
 struct Instruction
 {
-    byte code;
+    word_t code;    /* 0x100 | second byte for CB prefixed opcodes */
     byte length;
     byte cycles0;
     byte cycles1;
-    byte arg;
     const char *mnemonic;
-    Condition *condition;
+    bool (*condition)(CPU *cpu);
+    void (*execute)(CPU *cpu);
     CPU *cpu;
 
-    Instruction() : code(0), length(0), cycles0(0), cycles1(0), arg(0), mnemonic(), condition(0) {}
-    virtual ~Instruction() {
-        if (condition)
-            delete condition;
-    }
+    Instruction() : code(0), length(0), cycles0(0), cycles1(0), mnemonic(), condition(0), execute(0), cpu(0) {}
+    virtual ~Instruction() {}
 
     virtual void run() = 0;
 };
 
-template <class T>
-struct ReferenceInstruction : public Instruction
-{
-    Reference<T> *ref0;
-    Reference<T> *ref1;
-
-    ReferenceInstruction() : ref0(0), ref1(0) {}
-    virtual ~ReferenceInstruction() {
-        if (ref0)
-            delete ref0;
-        if (ref1)
-            delete ref1;
-    }
-};
+/*
+ * Every instruction is a template over the operand policies from
+ * references.h and its opcode argument (bit number, RST address). The
+ * static execute() is what the generated dispatch core inlines; run() lets
+ * the same code be reached through the InstructionSet tables. Operands from
+ * the instruction stream advance pc on their own, the caller only skips
+ * them for untaken conditionals.
+ */
 
 struct NOP_Instruction : public Instruction {
-    void run() {}
-};
+    static inline void execute(CPU * /* cpu */) {}
 
-template <class T>
-struct JP_Instruction : public ReferenceInstruction<T> {
+    void run() { execute(cpu); }
 };
 
-template <>
-struct JP_Instruction<word> : public ReferenceInstruction<word> {
-    void run() {
-        cpu->pc = ref0->get();
+template <class Src>
+struct JP_Instruction : public Instruction {
+    static inline void execute(CPU *cpu) {
+        cpu->pc = Src::get(cpu);
     }
-};
 
-template <class T>
-struct JR_Instruction : public ReferenceInstruction<T> {
+    void run() { execute(cpu); }
 };
 
-template <>
-struct JR_Instruction<byte> : public ReferenceInstruction<byte> {
-    void run() {
-        byte v = ref0->get();
-        cpu->pc++;
+template <class Src>
+struct JR_Instruction : public Instruction {
+    static inline void execute(CPU *cpu) {
+        byte v = Src::get(cpu);
         cpu->pc.addSignedByte(v);
     }
+
+    void run() { execute(cpu); }
 };
 
-template <class T>
-struct XOR_Instruction : public ReferenceInstruction<T> {
+template <class Src>
+struct XOR_Instruction : public Instruction {
+    static inline void execute(CPU *cpu) {
+        cpu->a ^= Src::get(cpu);
+        cpu->deferFlags(FLAGS_OR, 0, 0, cpu->a);
+    }
+
+    void run() { execute(cpu); }
 };
 
-template <>
-struct XOR_Instruction<byte> : public ReferenceInstruction<byte> {
-    void run() {
-        cpu->a ^= ref0->get();
-        cpu->flagZ(cpu->a == 0);
-        cpu->flagN(0);
-        cpu->flagH(0);
-        cpu->flagC(0);
-        cpu->pc += length-1;
+template <class Src>
+struct OR_Instruction : public Instruction {
+    static inline void execute(CPU *cpu) {
+        cpu->a |= Src::get(cpu);
+        cpu->deferFlags(FLAGS_OR, 0, 0, cpu->a);
+    }
+
+    void run() { execute(cpu); }
+};
+
+template <class Src>
+struct AND_Instruction : public Instruction {
+    static inline void execute(CPU *cpu) {
+        cpu->a &= Src::get(cpu);
+        cpu->deferFlags(FLAGS_AND, 0, 0, cpu->a);
     }
+
+    void run() { execute(cpu); }
 };
 
 struct RLCA_Instruction : public Instruction {
-    void run() {
+    static inline void execute(CPU *cpu) {
         byte bit7 = cpu->a & (1 << 7);
         cpu->a = cpu->a << 1;
         cpu->a = bit7 ? (cpu->a | 1) : (cpu->a & ~1);
@@ -150,10 +134,12 @@ struct RLCA_Instruction : public Instruction {
         cpu->flagN(0);
         cpu->flagC(bit7);
     }
+
+    void run() { execute(cpu); }
 };
 
 struct RLA_Instruction : public Instruction {
-    void run() {
+    static inline void execute(CPU *cpu) {
         byte bit7 = cpu->a & (1 << 7);
         byte cf = cpu->flagC() ? 1 : 0;
         cpu->a = cpu->a << 1;
@@ -164,10 +150,26 @@ struct RLA_Instruction : public Instruction {
         cpu->flagN(0);
         cpu->flagC(bit7);
     }
+
+    void run() { execute(cpu); }
+};
+
+struct RRCA_Instruction : public Instruction {
+    static inline void execute(CPU *cpu) {
+        byte bit0 = cpu->a & 1;
+        cpu->a >>= 1;
+
+        cpu->flagZ(cpu->a == 0);
+        cpu->flagH(0);
+        cpu->flagN(0);
+        cpu->flagC(bit0);
+    }
+
+    void run() { execute(cpu); }
 };
 
 struct DAA_Instruction : public Instruction {
-    void run() {
+    static inline void execute(CPU *cpu) {
         byte add  = 0;
         bool newc = false;
 
@@ -200,440 +202,360 @@ struct DAA_Instruction : public Instruction {
             break;
         }
 
+#undef DAA_COND
+
         cpu->a += add;
         cpu->flagZ(cpu->a == 0);
         cpu->flagH(0);
         cpu->flagC(newc);
     }
 
-    inline bool in_range(const byte &a, const byte &from, const byte &to) {
+    static inline bool in_range(const byte &a, const byte &from, const byte &to) {
         return a >= from && a <= to;
     }
-};
-
-template <class T>
-struct OR_Instruction : public ReferenceInstruction<T> {
-};
-
-template <>
-struct OR_Instruction<byte> : public ReferenceInstruction<byte> {
-    void run() {
-        cpu->a |= ref0->get();
-        cpu->flagZ(cpu->a == 0);
-        cpu->flagN(0);
-        cpu->flagH(0);
-        cpu->flagC(0);
-        cpu->pc += length-1;
-    }
-};
-
-template <class T>
-struct AND_Instruction : public ReferenceInstruction<T> {
-};
 
-template <>
-struct AND_Instruction<byte> : public ReferenceInstruction<byte> {
-    void run() {
-        cpu->a &= ref0->get();
-        cpu->flagZ(cpu->a == 0);
-        cpu->flagN(0);
-        cpu->flagH(1);
-        cpu->flagC(0);
-        cpu->pc += length-1;
-    };
+    void run() { execute(cpu); }
 };
 
 struct CPL_Instruction : public Instruction {
-    void run() {
+    static inline void execute(CPU *cpu) {
         cpu->a = ~cpu->a;
         cpu->flagN(1);
         cpu->flagH(1);
     }
+
+    void run() { execute(cpu); }
 };
 
 struct SCF_Instruction : public Instruction {
-    void run() {
+    static inline void execute(CPU *cpu) {
         cpu->flagN(0);
         cpu->flagH(0);
         cpu->flagC(1);
     }
-};
 
-template <class T>
-struct LD_Instruction : public ReferenceInstruction<T> {
+    void run() { execute(cpu); }
 };
 
-template <>
-struct LD_Instruction<byte> : public ReferenceInstruction<byte> {
-    void run() {
-        ref0->set(ref1->get());
-        cpu->pc += length-1;
+template <class Dst, class Src>
+struct LD_Instruction : public Instruction {
+    static inline void execute(CPU *cpu) {
+        Dst::set(cpu, Src::get(cpu));
     }
-};
 
-template <>
-struct LD_Instruction<word> : public ReferenceInstruction<word> {
-    void run() {
-        ref0->set(ref1->get());
-        cpu->pc += length-1;
-    }
+    void run() { execute(cpu); }
 };
 
-template <class T>
-struct ADD_Instruction : public ReferenceInstruction<T> {
+template <class Dst, class Src, class T = typename Dst::type>
+struct ADD_Instruction : public Instruction {
 };
 
-template <>
-struct ADD_Instruction<byte> : public ReferenceInstruction<byte> {
-    void run() {
-        flags f;
-        ref0->set(addByte(ref0->get(), ref1->get(), f));
-        cpu->flagZ(f.z);
-        cpu->flagN(0);
-        cpu->flagH(f.h);
-        cpu->flagC(f.c);
-        cpu->pc += length-1;
+template <class Dst, class Src>
+struct ADD_Instruction<Dst, Src, byte> : public Instruction {
+    static inline void execute(CPU *cpu) {
+        byte a = Dst::get(cpu);
+        byte b = Src::get(cpu);
+        byte r = a + b;
+        Dst::set(cpu, r);
+        cpu->deferFlags(FLAGS_ADD, a, b, r);
     }
+
+    void run() { execute(cpu); }
 };
 
-template <>
-struct ADD_Instruction<word> : public ReferenceInstruction<word> {
-    void run() {
+template <class Dst, class Src>
+struct ADD_Instruction<Dst, Src, word> : public Instruction {
+    static inline void execute(CPU *cpu) {
         flags f;
-        ref0->set(addWord(ref0->get(), ref1->get(), f));
+        Dst::set(cpu, addWord(Dst::get(cpu), Src::get(cpu), f));
         cpu->flagN(0);
         cpu->flagH(f.h);
         cpu->flagC(f.c);
-        cpu->pc += length-1;
     }
-};
 
-template <class T>
-struct ADD_SP_Instruction : public ReferenceInstruction<T> {
+    void run() { execute(cpu); }
 };
 
-template <>
-struct ADD_SP_Instruction<byte> : public ReferenceInstruction<byte> {
-    void run() {
+template <class Src>
+struct ADD_SP_Instruction : public Instruction {
+    static inline void execute(CPU *cpu) {
         flags f;
-        cpu->sp = addSignedByte(cpu->sp, ref0->get(), f);
+        cpu->sp = addSignedByte(cpu->sp, Src::get(cpu), f);
         cpu->flagZ(0);
         cpu->flagN(0);
         cpu->flagH(f.h);
         cpu->flagC(f.c);
-        cpu->pc += length-1;
     }
-};
 
-template <class T>
-struct SUB_Instruction : public ReferenceInstruction<T> {
+    void run() { execute(cpu); }
 };
 
-template <>
-struct SUB_Instruction<byte> : public ReferenceInstruction<byte> {
-    void run() {
-        flags f;
-        cpu->a = subByte(cpu->a, ref0->get(), f);
-        cpu->flagZ(f.z);
-        cpu->flagN(1);
-        cpu->flagH(f.h);
-        cpu->flagC(f.c);
-        cpu->pc += length-1;
+template <class Src>
+struct SUB_Instruction : public Instruction {
+    static inline void execute(CPU *cpu) {
+        byte a = cpu->a;
+        byte b = Src::get(cpu);
+        cpu->a = a - b;
+        cpu->deferFlags(FLAGS_SUB, a, b, cpu->a);
     }
-};
 
-template <class T>
-struct ADC_Instruction : public ReferenceInstruction<T> {
+    void run() { execute(cpu); }
 };
 
-template <>
-struct ADC_Instruction<byte> : public ReferenceInstruction<byte> {
-    void run() {
-        flags f;
-        ref0->set(addByte(ref0->get(), ref1->get() + (cpu->flagC() ? 1 : 0), f)); //TODO
-        cpu->flagZ(f.z);
-        cpu->flagN(0);
-        cpu->flagH(f.h);
-        cpu->flagC(f.c);
-        cpu->pc += length-1;
+template <class Dst, class Src>
+struct ADC_Instruction : public Instruction {
+    static inline void execute(CPU *cpu) {
+        byte a = Dst::get(cpu);
+        byte b = Src::get(cpu) + (cpu->flagC() ? 1 : 0); //TODO
+        byte r = a + b;
+        Dst::set(cpu, r);
+        cpu->deferFlags(FLAGS_ADD, a, b, r);
     }
-};
 
-template <class T>
-struct SBC_Instruction : public ReferenceInstruction<T> {
+    void run() { execute(cpu); }
 };
 
-template <>
-struct SBC_Instruction<byte> : public ReferenceInstruction<byte> {
-    void run() {
-        flags f;
-        ref0->set(subByte(ref0->get(), ref1->get() + (cpu->flagC() ? 1 : 0), f)); //TODO
-        cpu->flagZ(f.z);
-        cpu->flagN(1);
-        cpu->flagH(f.h);
-        cpu->flagC(f.c);
-        cpu->pc += length-1;
+template <class Dst, class Src>
+struct SBC_Instruction : public Instruction {
+    static inline void execute(CPU *cpu) {
+        byte a = Dst::get(cpu);
+        byte b = Src::get(cpu) + (cpu->flagC() ? 1 : 0); //TODO
+        byte r = a - b;
+        Dst::set(cpu, r);
+        cpu->deferFlags(FLAGS_SUB, a, b, r);
     }
+
+    void run() { execute(cpu); }
 };
 
-template <class T>
-struct INC_Instruction : public ReferenceInstruction<T> {
+template <class Dst, class T = typename Dst::type>
+struct INC_Instruction : public Instruction {
 };
 
-template <>
-struct INC_Instruction<byte> : public ReferenceInstruction<byte> {
-    void run() {
-        byte v = ref0->get() + (byte)1;
-        ref0->set(v);
-        cpu->flagZ(v == 0);
-        cpu->flagN(0);
-        cpu->flagH(0); // TODO: half carry flag
+template <class Dst>
+struct INC_Instruction<Dst, byte> : public Instruction {
+    static inline void execute(CPU *cpu) {
+        byte v = Dst::get(cpu) + (byte)1;
+        Dst::set(cpu, v);
+        cpu->deferFlags(FLAGS_INC, 0, cpu->flagC(), v); // TODO: half carry flag
     }
+
+    void run() { execute(cpu); }
 };
 
-template <>
-struct INC_Instruction<word> : public ReferenceInstruction<word> {
-    void run() {
-        ref0->set(ref0->get() + (word)1);
+template <class Dst>
+struct INC_Instruction<Dst, word> : public Instruction {
+    static inline void execute(CPU *cpu) {
+        Dst::set(cpu, Dst::get(cpu) + (word)1);
     }
+
+    void run() { execute(cpu); }
 };
 
-template <class T>
-struct DEC_Instruction : public ReferenceInstruction<T> {
+template <class Dst, class T = typename Dst::type>
+struct DEC_Instruction : public Instruction {
 };
 
-template <>
-struct DEC_Instruction<byte> : public ReferenceInstruction<byte> {
-    void run() {
-        byte v = ref0->get() - 1;
-        ref0->set(v);
-        cpu->flagZ(v == 0);
-        cpu->flagN(1);
-        cpu->flagH(0); // TODO: half carry flag
+template <class Dst>
+struct DEC_Instruction<Dst, byte> : public Instruction {
+    static inline void execute(CPU *cpu) {
+        byte v = Dst::get(cpu) - 1;
+        Dst::set(cpu, v);
+        cpu->deferFlags(FLAGS_DEC, 0, cpu->flagC(), v); // TODO: half carry flag
     }
+
+    void run() { execute(cpu); }
 };
 
-template <>
-struct DEC_Instruction<word> : public ReferenceInstruction<word> {
-    void run() {
-        ref0->set(ref0->get() - 1);
+template <class Dst>
+struct DEC_Instruction<Dst, word> : public Instruction {
+    static inline void execute(CPU *cpu) {
+        Dst::set(cpu, Dst::get(cpu) - 1);
     }
-};
 
-template <class T>
-struct CP_Instruction : public ReferenceInstruction<T> {
+    void run() { execute(cpu); }
 };
 
-template <>
-struct CP_Instruction<byte> : public ReferenceInstruction<byte> {
-    void run() {
-        flags f;
-        byte n = ref0->get();
-        subByte(cpu->a, n, f);
-        cpu->flagZ(cpu->a == n);
-        cpu->flagN(1);
-        cpu->flagH(f.h);
-        cpu->flagC(cpu->a < n);
-        cpu->pc += length-1;
+template <class Src>
+struct CP_Instruction : public Instruction {
+    static inline void execute(CPU *cpu) {
+        byte n = Src::get(cpu);
+        cpu->deferFlags(FLAGS_CP, cpu->a, n, cpu->a - n);
     }
-};
 
-template <class T>
-struct CALL_Instruction : public ReferenceInstruction<T> {
+    void run() { execute(cpu); }
 };
 
-template <>
-struct CALL_Instruction<word> : public ReferenceInstruction<word> {
-    void run() {
-        word address = ref0->get();
-        cpu->pc += length-1;
-        cpu->sp--;
-        cpu->memory->set(cpu->sp, cpu->pc_hi);
-        cpu->sp--;
-        cpu->memory->set(cpu->sp, cpu->pc_lo);
+template <class Src>
+struct CALL_Instruction : public Instruction {
+    static inline void execute(CPU *cpu) {
+        word address = Src::get(cpu);
+        Stack::push(cpu, cpu->pc);
         cpu->pc = address;
     }
+
+    void run() { execute(cpu); }
 };
 
+template <byte Address>
 struct RST_Instruction : public Instruction {
-    void run() {
-        cpu->sp--;
-        cpu->memory->set(cpu->sp, cpu->pc_hi);
-        cpu->sp--;
-        cpu->memory->set(cpu->sp, cpu->pc_lo);
-        cpu->pc = word(arg, 0x00);
+    static inline void execute(CPU *cpu) {
+        Stack::push(cpu, cpu->pc);
+        cpu->pc = word(Address, 0x00);
     }
-};
 
-template <class T>
-struct PUSH_Instruction : public ReferenceInstruction<T> {
+    void run() { execute(cpu); }
 };
 
-template <>
-struct PUSH_Instruction<word> : public ReferenceInstruction<word> {
-    void run() {
-        word value = ref0->get();
-        cpu->sp--;
-        cpu->memory->set(cpu->sp, value.hi());
-        cpu->sp--;
-        cpu->memory->set(cpu->sp, value.lo());
+template <class Src>
+struct PUSH_Instruction : public Instruction {
+    static inline void execute(CPU *cpu) {
+        Stack::push(cpu, Src::get(cpu));
     }
-};
 
-template <class T>
-struct POP_Instruction : public ReferenceInstruction<T> {
+    void run() { execute(cpu); }
 };
 
-template <>
-struct POP_Instruction<word> : public ReferenceInstruction<word> {
-    void run() {
-        word value;
-        value.setlo(cpu->memory->get<byte>(cpu->sp++));
-        value.sethi(cpu->memory->get<byte>(cpu->sp++));
-        ref0->set(value);
+template <class Dst>
+struct POP_Instruction : public Instruction {
+    static inline void execute(CPU *cpu) {
+        Dst::set(cpu, Stack::pop(cpu));
     }
+
+    void run() { execute(cpu); }
 };
 
 struct RET_Instruction : public Instruction {
-    void run() {
-        cpu->pc_lo = cpu->memory->get<byte>(cpu->sp++);
-        cpu->pc_hi = cpu->memory->get<byte>(cpu->sp++);
+    static inline void execute(CPU *cpu) {
+        cpu->pc = Stack::pop(cpu);
     }
+
+    void run() { execute(cpu); }
 };
 
 struct RETI_Instruction : public Instruction {
-    void run() {
-        cpu->pc_lo = cpu->memory->get<byte>(cpu->sp++);
-        cpu->pc_hi = cpu->memory->get<byte>(cpu->sp++);
+    static inline void execute(CPU *cpu) {
+        cpu->pc = Stack::pop(cpu);
         cpu->ime = 1;
     }
+
+    void run() { execute(cpu); }
 };
 
 struct DI_Instruction : public Instruction {
-    void run() {
+    static inline void execute(CPU *cpu) {
         cpu->ime = 0;
     }
+
+    void run() { execute(cpu); }
 };
 
 struct EI_Instruction : public Instruction {
-    void run() {
+    static inline void execute(CPU *cpu) {
         cpu->ime = 1;
     }
-};
 
-struct RRCA_Instruction : public Instruction {
-    void run() {
-        byte bit0 = cpu->a & 1;
-        cpu->a >>= 1;
+    void run() { execute(cpu); }
+};
 
-        cpu->flagZ(cpu->a == 0);
-        cpu->flagH(0);
-        cpu->flagN(0);
-        cpu->flagC(bit0);
+struct HALT_Instruction : public Instruction {
+    static inline void execute(CPU *cpu) {
+        cpu->halt();
     }
+
+    void run() { execute(cpu); }
 };
 
-template <class T>
-struct SWAP_Instruction : public ReferenceInstruction<T> {
+struct STOP_Instruction : public Instruction {
+    static inline void execute(CPU *cpu) {
+        // Skip the padding byte
+        cpu->pc++;
+        cpu->stop();
+    }
+
+    void run() { execute(cpu); }
 };
 
-template <>
-struct SWAP_Instruction<byte> : public ReferenceInstruction<byte> {
-    void run() {
-        byte v = ref0->get();
+template <class Dst>
+struct SWAP_Instruction : public Instruction {
+    static inline void execute(CPU *cpu) {
+        byte v = Dst::get(cpu);
         v = (v << 4) | (v >> 4);
-        ref0->set(v);
+        Dst::set(cpu, v);
         cpu->flagZ(v == 0);
         cpu->flagN(0);
         cpu->flagH(0);
         cpu->flagC(0);
     }
-};
 
-template <class T>
-struct RES_Instruction : public ReferenceInstruction<T> {
+    void run() { execute(cpu); }
 };
 
-template <>
-struct RES_Instruction<byte> : public ReferenceInstruction<byte> {
-    void run() {
-        byte v = ref0->get();
-        v = v & ~(1 << arg);
-        ref0->set(v);
+template <int Bit, class Dst>
+struct RES_Instruction : public Instruction {
+    static inline void execute(CPU *cpu) {
+        byte v = Dst::get(cpu);
+        v = v & ~(1 << Bit);
+        Dst::set(cpu, v);
     }
-};
 
-template <class T>
-struct BIT_Instruction : public ReferenceInstruction<T> {
+    void run() { execute(cpu); }
 };
 
-template <>
-struct BIT_Instruction<byte> : public ReferenceInstruction<byte> {
-    void run() {
-        cpu->flagZ((ref0->get() & (1 << arg)) == 0);
+template <int Bit, class Src>
+struct BIT_Instruction : public Instruction {
+    static inline void execute(CPU *cpu) {
+        cpu->flagZ((Src::get(cpu) & (1 << Bit)) == 0);
         cpu->flagN(0);
         cpu->flagH(1);
     }
-};
 
-template <class T>
-struct SET_Instruction : public ReferenceInstruction<T> {
+    void run() { execute(cpu); }
 };
 
-template <>
-struct SET_Instruction<byte> : public ReferenceInstruction<byte> {
-    void run() {
-        byte b = ref0->get();
-        b |= (1 << arg);
-        ref0->set(b);
+template <int Bit, class Dst>
+struct SET_Instruction : public Instruction {
+    static inline void execute(CPU *cpu) {
+        byte b = Dst::get(cpu);
+        b |= (1 << Bit);
+        Dst::set(cpu, b);
     }
-};
 
-template <class T>
-struct SLA_Instruction : public ReferenceInstruction<T> {
+    void run() { execute(cpu); }
 };
 
-template <>
-struct SLA_Instruction<byte> : public ReferenceInstruction<byte> {
-    void run() {
-        byte v = ref0->get();
+template <class Dst>
+struct SLA_Instruction : public Instruction {
+    static inline void execute(CPU *cpu) {
+        byte v = Dst::get(cpu);
         byte bit7 = v & (1 << 7);
         v <<= 1;
-        ref0->set(v);
+        Dst::set(cpu, v);
 
         cpu->flagZ(v == 0);
         cpu->flagH(0);
         cpu->flagN(0);
         cpu->flagC(bit7);
     }
-};
 
-template <class T>
-struct SRL_Instruction : public ReferenceInstruction<T> {
+    void run() { execute(cpu); }
 };
 
-template <>
-struct SRL_Instruction<byte> : public ReferenceInstruction<byte> {
-    void run() {
-        byte v = ref0->get();
+template <class Dst>
+struct SRL_Instruction : public Instruction {
+    static inline void execute(CPU *cpu) {
+        byte v = Dst::get(cpu);
         byte bit0 = v & 1;
         v >>= 1;
-        ref0->set(v);
+        Dst::set(cpu, v);
 
         cpu->flagZ(v == 0);
         cpu->flagH(0);
         cpu->flagN(0);
         cpu->flagC(bit0);
     }
-};
-
-class InstructionSet;
 
-struct CB_Instruction : public Instruction {
-    InstructionSet *instructionSet;
-    virtual ~CB_Instruction();
-    CB_Instruction();
-    void run();
+    void run() { execute(cpu); }
 };
 
 #endif
@@ -6,7 +6,7 @@
 
 InstructionSet::InstructionSet()
 {
-    memset(instructions, 0, sizeof(Instruction *) * 256);
+    memset(instructions, 0, sizeof(Instruction *) * 512);
 }
 
 void InstructionSet::add(Instruction *instruction)
@@ -16,12 +16,12 @@ void InstructionSet::add(Instruction *instruction)
 
 InstructionSet::~InstructionSet()
 {
-    for (int i = 0; i < 256; ++i)
+    for (int i = 0; i < 512; ++i)
         if (instructions[i])
             delete instructions[i];
 }
 
-Instruction * InstructionSet::findInstruction(byte code)
+Instruction * InstructionSet::findInstruction(word_t code)
 {
     return instructions[code];
 }
\ No newline at end of file
@@ -9,13 +9,13 @@ class CPU;
 class InstructionSet
 {
 private:
-    Instruction *instructions[256];
+    Instruction *instructions[512];
 
 public:
     InstructionSet();
     ~InstructionSet();
 
-    Instruction * findInstruction(byte code);
+    Instruction * findInstruction(word_t code);
     void add(Instruction *instruction);
 };
 
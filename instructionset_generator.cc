@@ -12,9 +12,8 @@
 
 using namespace std;
 
-static map<string,string> byteArguments;
-static map<string,string> wordArguments;
-static map<string,string> condArguments;
+static map<string,string> operandPolicies;
+static map<string,string> condPolicies;
 static vector<string> condOps;
 
 string extractInstructionsetName(string fileName)
@@ -70,23 +69,32 @@ void split(const string &str, char sep, vector<string> &v)
     }
 }
 
-string codeForArgument(const string &argument)
+string policyForArgument(const string &argument)
 {
-    if (byteArguments.find(argument) != byteArguments.end())
-        return byteArguments[argument];
-    if (wordArguments.find(argument) != wordArguments.end())
-        return wordArguments[argument];
+    if (operandPolicies.find(argument) != operandPolicies.end())
+        return operandPolicies[argument];
 
-    cerr << "Cannot find code for argument '" << argument << "'" << endl;
+    cerr << "Cannot find operand policy for argument '" << argument << "'" << endl;
     exit(1);
 }
 
-string generateInstructionCodeForLine(const string &line)
+struct InstructionLine
 {
-    if (line.length() == 0 || line[0] == '#')
-        return "";
+    string mnemonic;
+    string assembly;
+    string code;
+    string length;
+    string cycles0;
+    string cycles1;
+    string condition;
+    string arg;
+    vector<string> args;
+};
 
-    stringstream output;
+bool parseLine(const string &line, const string &prefix, InstructionLine &insn)
+{
+    if (line.length() == 0 || line[0] == '#')
+        return false;
 
     vector<string> items;
     split(line, ' ', items);
@@ -96,113 +104,151 @@ string generateInstructionCodeForLine(const string &line)
         exit(1);
     }
 
-    vector<string> args;
+    vector<string> &args = insn.args;
+    args.clear();
     if (items.size() > 4)
         split(items[4], ',', args);
 
-    string mnemonic = items[3];
-    string assembly = items[3] + (items.size() > 4 ? " " + items[4] : "");
-    string code = items[0];
-    string length = items[1];
-    string condition;
+    insn.mnemonic = items[3];
+    insn.assembly = items[3] + (items.size() > 4 ? " " + items[4] : "");
+    insn.code = prefix + items[0];
+    insn.length = items[1];
+    insn.condition = "";
+    insn.arg = "";
 
     vector<string> cycles;
     split(items[2], '/', cycles);
-    string cycles0 = cycles.size() > 0 ? cycles[0] : "0";
-    string cycles1 = cycles.size() > 1 ? cycles[1] : "0";
+    insn.cycles0 = cycles.size() > 0 ? cycles[0] : "0";
+    insn.cycles1 = cycles.size() > 1 ? cycles[1] : "0";
 
     if (args.size() > 0 &&
-        find(condOps.begin(), condOps.end(), mnemonic) != condOps.end() &&
-        condArguments.find(args[0]) != condArguments.end()) 
+        find(condOps.begin(), condOps.end(), insn.mnemonic) != condOps.end() &&
+        condPolicies.find(args[0]) != condPolicies.end()) 
     {
-        condition = condArguments[args[0]];
+        insn.condition = args[0];
         args.erase(args.begin());
     }
 
-    string arg;
     if (args.size() > 0 && (args[0][0] >= '0' && args[0][0] <= '9')) {
-        arg = args[0];
+        string arg = args[0];
         args.erase(args.begin());
         if (arg[arg.size()-1] == 'H')
             arg = "0x" + arg.substr(0, arg.size()-1);
+        insn.arg = arg;
     }
 
-    string op;
-    string templateArgument;
-    if (args.size() > 0) {
-        // TODO
-        if (byteArguments.find(args[0]) != byteArguments.end()) {
-            templateArgument = "<byte>";
-            op = "op1";
-        } else {
-            templateArgument = "<word>";
-            op = "op2";
-        }
-    } else {
-        op = "op0";
+    return true;
+}
+
+string instructionType(const InstructionLine &insn)
+{
+    vector<string> templateArguments;
+    if (insn.arg != "")
+        templateArguments.push_back(insn.arg);
+    for (vector<string>::const_iterator it = insn.args.begin(); it != insn.args.end(); ++it)
+        templateArguments.push_back(policyForArgument(*it));
+
+    string type = insn.mnemonic + "_Instruction";
+    if (templateArguments.size() > 0) {
+        type += "<" + boost::join(templateArguments, ", ");
+        type += (type[type.size()-1] == '>') ? " >" : ">";
     }
+    return type;
+}
+
+string generateInstructionCodeForLine(const string &line, const string &prefix)
+{
+    InstructionLine insn;
+    if (!parseLine(line, prefix, insn))
+        return "";
+
+    stringstream output;
 
     output << "    // " << line << endl;
-    output << "    " << op << " = new " << mnemonic << "_Instruction" << templateArgument << "();" << endl
-           << "    " << op << "->cpu = cpu;" << endl
-           << "    " << op << "->code = 0x" << code << ";" << endl
-           << "    " << op << "->length = " << length << ";" << endl
-           << "    " << op << "->cycles0 = " << cycles0 << ";" << endl
-           << "    " << op << "->cycles1 = " << cycles1 << ";" << endl
-           << "    " << op << "->mnemonic = \"" << assembly << "\";" << endl;
-
-    if (condition != "") {
-        output << "    " << op << "->condition = " << condition << ";" << endl;
+    output << "    op = new " << instructionType(insn) << "();" << endl
+           << "    op->cpu = cpu;" << endl
+           << "    op->code = 0x" << insn.code << ";" << endl
+           << "    op->length = " << insn.length << ";" << endl
+           << "    op->cycles0 = " << insn.cycles0 << ";" << endl
+           << "    op->cycles1 = " << insn.cycles1 << ";" << endl
+           << "    op->mnemonic = \"" << insn.assembly << "\";" << endl
+           << "    op->execute = &" << instructionType(insn) << "::execute;" << endl;
+
+    if (insn.condition != "") {
+        output << "    op->condition = &" << condPolicies[insn.condition] << "::test;" << endl;
     }
 
-    if (arg != "") {
-        output << "    " << op << "->arg = " << arg << ";" << endl;
-    }
+    output << "    instructionSet->add(op);" << endl;
 
-    int i = 0;
-    for (vector<string>::iterator it = args.begin(); it != args.end(); ++it) {
-        output << "    " << op << "->ref" << i << " = " << codeForArgument(*it) << ";" << endl;
-        ++i;
+    return output.str();
+}
+
+string generateDispatchCodeForLine(const string &line, const string &prefix)
+{
+    InstructionLine insn;
+    if (!parseLine(line, prefix, insn))
+        return "";
+
+    stringstream output;
+
+    string instruction = instructionType(insn);
+
+    output << "    // " << line << endl
+           << "    case 0x" << insn.code << ":" << endl;
+
+    if (insn.condition != "") {
+        int skip = atoi(insn.length.c_str()) - 1;
+        output << "        if (" << condPolicies[insn.condition] << "::test(cpu)) {" << endl
+               << "            " << instruction << "::execute(cpu);" << endl
+               << "            cpu->cycles += " << insn.cycles0 << ";" << endl
+               << "        } else {" << endl;
+        if (skip > 0)
+            output << "            cpu->pc += " << skip << ";" << endl;
+        output << "            cpu->cycles += " << insn.cycles1 << ";" << endl
+               << "        }" << endl;
+    } else {
+        output << "        " << instruction << "::execute(cpu);" << endl;
+        if (insn.cycles0 != "0")
+            output << "        cpu->cycles += " << insn.cycles0 << ";" << endl;
     }
-    output << "    instructionSet->add(" << op << ");" << endl;
+    output << "        return true;" << endl;
 
     return output.str();
 }
 
 static void init()
 {
-    byteArguments["(BC)"]  = "new MemoryReference<byte>(cpu, cpu->bc)";
-    byteArguments["(C)"]   = "new Memory_SingleRegister_Reference<byte>(cpu, cpu->c)";
-    byteArguments["(DE)"]  = "new MemoryReference<byte>(cpu, cpu->de)";
-    byteArguments["(HL)"]  = "new MemoryReference<byte>(cpu, cpu->hl)";
-    byteArguments["(HL+)"] = "new Memory_HL_Reference<byte>(cpu, cpu->hl, 1)";
-    byteArguments["(HL-)"] = "new Memory_HL_Reference<byte>(cpu, cpu->hl, -1)";
-    byteArguments["(a8)"]  = "new Memory_a8_Reference<byte>(cpu, cpu->pc)";
-    byteArguments["(a16)"] = "new Memory_a16_Reference<byte>(cpu, cpu->pc)";
-    byteArguments["A"]     = "new RegisterReference<byte>(cpu->a)";
-    byteArguments["B"]     = "new RegisterReference<byte>(cpu->b)";
-    byteArguments["C"]     = "new RegisterReference<byte>(cpu->c)";
-    byteArguments["D"]     = "new RegisterReference<byte>(cpu->d)";
-    byteArguments["E"]     = "new RegisterReference<byte>(cpu->e)";
-    byteArguments["F"]     = "new RegisterReference<byte>(cpu->f)";
-    byteArguments["H"]     = "new RegisterReference<byte>(cpu->h)";
-    byteArguments["L"]     = "new RegisterReference<byte>(cpu->l)";
-    byteArguments["d8"]    = "new MemoryReference<byte>(cpu, cpu->pc)";
-    byteArguments["r8"]    = "new MemoryReference<byte>(cpu, cpu->pc)";
-
-    wordArguments["SP"]    = "new RegisterReference<word>(cpu->sp)";
-    wordArguments["AF"]    = "new RegisterReference<word>(cpu->af)";
-    wordArguments["BC"]    = "new RegisterReference<word>(cpu->bc)";
-    wordArguments["DE"]    = "new RegisterReference<word>(cpu->de)";
-    wordArguments["HL"]    = "new RegisterReference<word>(cpu->hl)";
-    wordArguments["a16"]   = "new MemoryReference<word>(cpu, cpu->pc)";
-    wordArguments["d16"]   = "new MemoryReference<word>(cpu, cpu->pc)";
-    wordArguments["[a16]"] = "new Memory_a16_Reference<word>(cpu, cpu->pc)";
-
-    condArguments["NZ"]    = "new NZ_Condition()";
-    condArguments["NC"]    = "new NC_Condition()";
-    condArguments["Z"]     = "new Z_Condition()";
-    condArguments["C"]     = "new C_Condition()";
+    operandPolicies["(BC)"]  = "Memory_Register<REG_BC>";
+    operandPolicies["(C)"]   = "Memory_C";
+    operandPolicies["(DE)"]  = "Memory_Register<REG_DE>";
+    operandPolicies["(HL)"]  = "Memory_Register<REG_HL>";
+    operandPolicies["(HL+)"] = "Memory_HL<1>";
+    operandPolicies["(HL-)"] = "Memory_HL<-1>";
+    operandPolicies["(a8)"]  = "Memory_a8<byte>";
+    operandPolicies["(a16)"] = "Memory_a16<byte>";
+    operandPolicies["A"]     = "Reg_A";
+    operandPolicies["B"]     = "Reg_B";
+    operandPolicies["C"]     = "Reg_C";
+    operandPolicies["D"]     = "Reg_D";
+    operandPolicies["E"]     = "Reg_E";
+    operandPolicies["F"]     = "Reg_F";
+    operandPolicies["H"]     = "Reg_H";
+    operandPolicies["L"]     = "Reg_L";
+    operandPolicies["d8"]    = "Immediate<byte>";
+    operandPolicies["r8"]    = "Immediate<byte>";
+    operandPolicies["SP"]    = "Reg_SP";
+    operandPolicies["AF"]    = "Reg_AF";
+    operandPolicies["BC"]    = "Reg_BC";
+    operandPolicies["DE"]    = "Reg_DE";
+    operandPolicies["HL"]    = "Reg_HL";
+    operandPolicies["a16"]   = "Immediate<word>";
+    operandPolicies["d16"]   = "Immediate<word>";
+    operandPolicies["[a16]"] = "Memory_a16<word>";
+
+    condPolicies["NZ"]       = "NZ_Condition";
+    condPolicies["NC"]       = "NC_Condition";
+    condPolicies["Z"]        = "Z_Condition";
+    condPolicies["C"]        = "C_Condition";
 
     condOps.push_back("JR");
     condOps.push_back("JP");
@@ -210,48 +256,89 @@ static void init()
     condOps.push_back("CALL");
 }
 
-int main(int argc, char *argv[])
+/*
+ * Base opcodes take the codes 0x000-0x0ff of the table, CB prefixed ones
+ * 0x100-0x1ff.
+ */
+bool generateCodeForFile(const char *inputFile, const string &prefix, bool dispatch, ostream &outfile)
 {
-    if (argc != 3) {
-        cerr << "Usage: " << argv[0] << " <input file> <output file>" << endl;
-        return 1;
+    ifstream infile(inputFile);
+    if (!infile.is_open()) {
+        cerr << "Cannot open file " << inputFile << endl;
+        return false;
     }
 
-    ifstream infile(argv[1]);
-    if (!infile.is_open()) {
-        cerr << "Cannot open file " << argv[1] << endl;
+    string line;
+    while (infile.good()) {
+        getline(infile, line);
+        if (dispatch)
+            outfile << generateDispatchCodeForLine(line, prefix);
+        else
+            outfile << generateInstructionCodeForLine(line, prefix) << endl;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    bool dispatch = argc == 5 && string(argv[1]) == "--dispatch";
+    if (argc != 4 && !dispatch) {
+        cerr << "Usage: " << argv[0] << " [--dispatch] <base input file> <cb input file> <output file>" << endl;
         return 1;
     }
 
-    ofstream outfile(argv[2]);
+    const char *baseFile = argv[argc-3];
+    const char *cbFile = argv[argc-2];
+    const char *outputFile = argv[argc-1];
+
+    ofstream outfile(outputFile);
     if (!outfile.is_open()) {
-        cerr << "Cannot open file " << argv[2] << endl;
+        cerr << "Cannot open file " << outputFile << endl;
         return 1;
     }
 
     init();
 
-    string instructionsetName = extractInstructionsetName(argv[2]);
+    string instructionsetName = extractInstructionsetName(outputFile);
     string upperInstructionsetName = boost::to_upper_copy(instructionsetName);
 
     outfile << "#ifndef " << upperInstructionsetName << "_H" << endl
             << "#define " << upperInstructionsetName << "_H" << endl
             << endl
-            << "#include \"cpu.h\"" << endl
-            << "#include \"instructions.h\"" << endl
-            << "#include \"instructionset.h\"" << endl
-            << "#include \"references.h\"" << endl
-            << endl
-            << "void initialize_" << instructionsetName << "(InstructionSet *instructionSet, CPU *cpu) {" << endl
-            << "    Instruction *op0;" << endl
-            << "    ReferenceInstruction<byte> *op1;" << endl
-            << "    ReferenceInstruction<word> *op2;" << endl
-            << endl;
+            << "#include \"cpu.h\"" << endl;
+
+    if (dispatch) {
+        outfile << "#include \"instructions.h\"" << endl
+                << "#include \"references.h\"" << endl
+                << endl
+                << "inline bool " << instructionsetName << "(CPU *cpu, byte code) {" << endl
+                << "    word_t op = code;" << endl
+                << "    if (code == 0xcb) {" << endl
+                << "        op = 0x100 | cpu->memory->get<byte>(cpu->pc);" << endl
+                << "        cpu->pc++;" << endl
+                << "    }" << endl
+                << endl
+                << "    switch (op) {" << endl;
+    } else {
+        outfile << "#include \"instructions.h\"" << endl
+                << "#include \"instructionset.h\"" << endl
+                << "#include \"references.h\"" << endl
+                << endl
+                << "void initialize_" << instructionsetName << "(InstructionSet *instructionSet, CPU *cpu) {" << endl
+                << "    Instruction *op;" << endl
+                << endl;
+    }
 
-    string line;
-    while (infile.good()) {
-        getline(infile, line);
-        outfile << generateInstructionCodeForLine(line) << endl;
+    if (!generateCodeForFile(baseFile, "0", dispatch, outfile) ||
+        !generateCodeForFile(cbFile, "1", dispatch, outfile))
+        return 1;
+
+    if (dispatch) {
+        outfile << "    default:" << endl
+                << "        if (op != code)" << endl
+                << "            cpu->pc--;" << endl
+                << "        return false;" << endl
+                << "    }" << endl;
     }
 
     outfile << "}" << endl
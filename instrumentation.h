@@ -0,0 +1,29 @@
+#ifndef INSTRUMENTATION_H
+#define INSTRUMENTATION_H
+
+#include "cpu.h"
+#include "debugger.h"
+
+/*
+ * Instrumentation policies for CPU::step. The release policy compiles the
+ * debugger hooks away and lets whole blocks run; CPU::step only picks the
+ * debugger policy while the debugger has something to do.
+ */
+
+struct NoInstrumentation
+{
+    static const bool BLOCKS = true;
+
+    static inline void instruction(CPU * /* cpu */, word /* address */) {};
+};
+
+struct DebuggerInstrumentation
+{
+    static const bool BLOCKS = false;
+
+    static inline void instruction(CPU *cpu, word address) {
+        cpu->debugger->handleInstruction(cpu, address);
+    };
+};
+
+#endif
@@ -1,11 +1,18 @@
+#include <chrono>
+#include <cstdio>
 #include <iostream>
 #include <string>
 #include <cstdlib>
+#include <thread>
 
 #if defined(__APPLE__)
 #include <GLUT/glut.h>
+#include <OpenGL/OpenGL.h>
+#elif defined(WIN32)
+#include <GL/glut.h>
 #else
 #include <GL/glut.h>
+#include <GL/glx.h>
 #endif
 
 #ifndef GL_CLAMP_TO_EDGE // Not defined in Microsofts ancient headers
@@ -14,9 +21,13 @@
 
 #include "gameboy.h"
 #include "debugger.h"
+#include "emulatorthread.h"
 
 static GameBoy *gb = 0;
+static EmulatorThread *emulator = 0;
 static int zoom = 2;
+static uint32_t pixels[GB_DISPLAY_WIDTH * GB_DISPLAY_HEIGHT];
+static GLuint texture = 0;
 
 static void resize(int width, int height)
 {
@@ -28,13 +39,46 @@ static void resize(int width, int height)
     glMatrixMode(GL_MODELVIEW);
 }
 
+/* Waits for the vertical retrace on swaps where the platform allows it */
+static void enableVsync()
+{
+#if defined(__APPLE__)
+    GLint interval = 1;
+    CGLSetParameter(CGLGetCurrentContext(), kCGLCPSwapInterval, &interval);
+#elif defined(WIN32)
+    typedef BOOL (WINAPI *SwapIntervalEXT)(int);
+    SwapIntervalEXT swapInterval = (SwapIntervalEXT)wglGetProcAddress("wglSwapIntervalEXT");
+    if (swapInterval)
+        swapInterval(1);
+#else
+    typedef int (*SwapIntervalSGI)(int);
+    SwapIntervalSGI swapInterval = (SwapIntervalSGI)glXGetProcAddressARB((const GLubyte *)"glXSwapIntervalSGI");
+    if (swapInterval)
+        swapInterval(1);
+#endif
+}
+
 static void init()
 {
     glClearColor(0.0f, 0.0f, 1.0f, 1.0f);
+
+    // The texture is allocated once, frames only replace its contents
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, GB_DISPLAY_WIDTH, GB_DISPLAY_HEIGHT,
+                 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glEnable(GL_TEXTURE_2D);
+
+    enableVsync();
 }
 
 static void cleanup()
 {
+    delete emulator;
     delete gb;
 }
 
@@ -43,13 +87,9 @@ static void draw()
     glClear(GL_COLOR_BUFFER_BIT);
     glLoadIdentity();
 
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, GB_DISPLAY_WIDTH, GB_DISPLAY_HEIGHT,
-                 0, GL_RGB, GL_UNSIGNED_BYTE, gb->getScreen());
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glEnable(GL_TEXTURE_2D);
+    shadesToRGBA(emulator->latestFrame(), pixels, GB_DISPLAY_WIDTH * GB_DISPLAY_HEIGHT);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, GB_DISPLAY_WIDTH, GB_DISPLAY_HEIGHT,
+                    GL_RGBA, GL_UNSIGNED_BYTE, pixels);
 
     glBegin(GL_QUADS);
         glTexCoord2f(0.0f, 0.0f);
@@ -65,28 +105,44 @@ static void draw()
         glVertex2f(0.0f, 1.0f);
     glEnd();
 
-    glFlush();
+    glutSwapBuffers();
 }
 
+/* Emulation runs on its own thread, the window only shows what it finished */
 static void idle()
 {
-    if (gb->process())
+    // Tear down here, between callbacks, rather than under them on the emulator thread
+    if (emulator->isQuitRequested())
+        exit(0);
+
+    double fps, speed;
+    if (emulator->takeStats(fps, speed)) {
+        char title[64];
+        snprintf(title, sizeof(title), "gb%s - %.1f fps (%.2fx)",
+                 emulator->isTurbo() ? " [turbo]" : "", fps, speed);
+        glutSetWindowTitle(title);
+    }
+
+    if (emulator->hasFrame())
         glutPostRedisplay();
+    else
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
 }
 
 static void setKey(unsigned char key, bool down)
 {
     switch (key) {
-    case 'd': gb->setButton(BTN_RIGHT,  down); break;
-    case 'a': gb->setButton(BTN_LEFT,   down); break;
-    case 'w': gb->setButton(BTN_UP,     down); break;
-    case 's': gb->setButton(BTN_DOWN,   down); break;
-    case 'o': gb->setButton(BTN_A,      down); break;
-    case 'p': gb->setButton(BTN_B,      down); break;
-    case 'u': gb->setButton(BTN_SELECT, down); break;
-    case 'i': gb->setButton(BTN_START,  down); break;
-    case 'v': if (!down) { gb->getDebugger()->verboseCPU = !gb->getDebugger()->verboseCPU; } break;
-    case 'b': if (!down) { gb->getDebugger()->stepMode = true; } break;
+    case 'd': emulator->setButton(BTN_RIGHT,  down); break;
+    case 'a': emulator->setButton(BTN_LEFT,   down); break;
+    case 'w': emulator->setButton(BTN_UP,     down); break;
+    case 's': emulator->setButton(BTN_DOWN,   down); break;
+    case 'o': emulator->setButton(BTN_A,      down); break;
+    case 'p': emulator->setButton(BTN_B,      down); break;
+    case 'u': emulator->setButton(BTN_SELECT, down); break;
+    case 'i': emulator->setButton(BTN_START,  down); break;
+    case 'v': if (!down) { emulator->toggleVerbose(); } break;
+    case 'b': if (!down) { emulator->requestBreak(); } break;
+    case 'f': if (!down) { emulator->setTurbo(!emulator->isTurbo()); } break;
     }
 }
 
@@ -103,7 +159,7 @@ static void keyUp(unsigned char key, int x, int y)
 int main(int argc, char *argv[])
 {
     if (argc < 2) {
-        std::cerr << "Usage: " << argv[0] << " [sv] rom" << std::endl;
+        std::cerr << "Usage: " << argv[0] << " [svjtf] rom" << std::endl;
         return 1;
     }
 
@@ -116,9 +172,13 @@ int main(int argc, char *argv[])
     std::string options(argc > 2 ? argv[1] : "");
     gb->getDebugger()->stepMode = options.find_first_of('s') != std::string::npos;
     gb->getDebugger()->verboseCPU = options.find_first_of('v') != std::string::npos;
+    if (options.find_first_of('j') != std::string::npos && !gb->setRecompiler(true))
+        std::cerr << "Recompiler not available, using the interpreter" << std::endl;
+    if (options.find_first_of('t') != std::string::npos && !gb->setTrace("gb.trace"))
+        return 1;
 
     glutInit(&argc, argv);
-    glutInitDisplayMode(GLUT_SINGLE | GLUT_RGBA);
+    glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGBA);
     glutInitWindowSize(GB_DISPLAY_WIDTH * zoom, GB_DISPLAY_HEIGHT * zoom);
     glutCreateWindow("gb");
 
@@ -131,6 +191,10 @@ int main(int argc, char *argv[])
     glutKeyboardFunc(keyDown);
     glutKeyboardUpFunc(keyUp);
 
+    emulator = new EmulatorThread(gb);
+    emulator->setTurbo(options.find_first_of('f') != std::string::npos);
+    emulator->start();
+
     glutMainLoop();
 
     return 0;
@@ -1,69 +1,183 @@
 #include <stdio.h>
+#include <string.h>
 
 #include <iostream>
-#include <fstream>
 
 #include "memory.h"
 #include "debugger.h"
+#include "blockcache.h"
+#include "tilecache.h"
+#include "cartridge.h"
 
-Memory::Memory(const char *file, Debugger *debugger) : debugger(debugger)
+Memory::Memory(const char *file, Debugger *debugger) : debugger(debugger), blockCache(0), tileCache(0), ioHandler(0)
 {
-    std::ifstream is;
-    is.open(file, std::ios::binary);
+    cartridge = new Cartridge(file);
 
-    if (is.fail()) {
-        std::cerr << "Cannot open file: " << file << std::endl;
-        exit(1);
+    ram = new byte[65536];
+    memset(ram, 0, 65536);
+    memset(openBus, 0xff, sizeof(openBus));
+
+    for (int page = 0; page < PAGE_COUNT; ++page) {
+        // 0xe000-0xfdff echoes work RAM, and takes its flags from there
+        bool echo = page >= 0xe0 && page < 0xfe;
+        pages[page] = ram + ((echo ? page - 0x20 : page) << 8);
+        pageFlags[page] = echo ? PAGE_ECHO : 0;
+        if (page == 0xff)
+            pageFlags[page] |= PAGE_IO;
+        mapPage(page);
     }
+    mapCartridge();
+}
+
+Memory::~Memory()
+{
+    delete [] ram;
+    delete cartridge;
+}
 
-    is.seekg(0, std::ios::end);
-    int size = is.tellg();
-    is.seekg(0, std::ios::beg);
+/* Bank switching only swaps page pointers */
+void Memory::mapCartridge()
+{
+    lowBank = cartridge->lowBank();
+    highBank = cartridge->highBank();
+    ramBank = cartridge->ramBank();
 
-    rom = new byte[65536];
-    memset(rom, 0, 65536);
+    byte *low = cartridge->romData(lowBank);
+    byte *high = cartridge->romData(highBank);
+    for (int page = 0; page < 0x40; ++page) {
+        pages[page] = low + (page << 8);
+        pages[page + 0x40] = high + (page << 8);
+        pageFlags[page] |= PAGE_READ_ONLY;
+        pageFlags[page + 0x40] |= PAGE_READ_ONLY;
+        mapPage(page);
+        mapPage(page + 0x40);
+    }
 
-    is.read((char*)rom, size);
-    is.close();
+    for (int page = 0xa0; page < 0xc0; ++page) {
+        if (ramBank < 0) {
+            pages[page] = openBus;
+            pageFlags[page] |= PAGE_READ_ONLY;
+        } else {
+            int offset = (page - 0xa0) << 8;
+            pages[page] = cartridge->ramData(ramBank) + offset;
+            pageFlags[page] &= ~(PAGE_READ_ONLY | PAGE_SAVE_CLEAN);
+            if (cartridge->hasBattery() && !cartridge->isDirty(ramBank, offset))
+                pageFlags[page] |= PAGE_SAVE_CLEAN;
+        }
+        mapPage(page);
+    }
 }
 
-Memory::~Memory()
+void Memory::mapPage(int page)
 {
-    delete rom;
+    byte flags = pageFlags[page];
+    readPages[page] = (flags & (PAGE_IO | PAGE_WATCH_READ | PAGE_ECHO)) ? 0 : pages[page];
+    writePages[page] = (flags & ~PAGE_WATCH_READ) ? 0 : pages[page];
+}
+
+void Memory::setPageFlags(int page, byte flags, bool enable)
+{
+    if (enable)
+        pageFlags[page] |= flags;
+    else
+        pageFlags[page] &= ~flags;
+    mapPage(page);
+}
+
+void Memory::setTileCache(TileCache *cache)
+{
+    tileCache = cache;
+    for (int page = 0x80; page < 0x98; ++page)
+        setPageFlags(page, PAGE_TILES, cache != 0);
+}
+
+void Memory::updateWatches()
+{
+    for (int page = 0; page < PAGE_COUNT; ++page) {
+        setPageFlags(page, PAGE_WATCH_READ, debugger->isWatchingPage(page, false));
+        setPageFlags(page, PAGE_WATCH_WRITE, debugger->isWatchingPage(page, true));
+    }
+}
+
+/* Pages written since the last flush lost their flag, set it again */
+void Memory::flushSaveRam()
+{
+    if (!cartridge->flush(false) || ramBank < 0)
+        return;
+    for (int page = 0xa0; page < 0xc0; ++page)
+        setPageFlags(page, PAGE_SAVE_CLEAN, true);
 }
 
 void Memory::dmaTransfer(byte b) {
     byte c = 0x00;
     while (c <= 0x9f) {
-        rom[word(c, 0xfe).value()] = rom[word(c, b).value()];
+        getRef(word(c, 0xfe)) = getRef(word(c, b));
         c++;
     }
 }
 
-template <> void Memory::set<byte>(word address, byte b) {
-    if (address < 0x8000) {
-        //TODO: rom bank switching
+byte Memory::readSlow(word address)
+{
+    word_t a = address.value();
+    byte flags = pageFlags[a >> 8];
+    if (flags & PAGE_ECHO)
+        return get<byte>(a - 0x2000);
+
+    byte value;
+    if ((flags & PAGE_IO) && ioHandler && a < 0xff80)
+        value = ioHandler->readIO(address);
+    else
+        value = pages[a >> 8][a & 0xff];
+
+    if (flags & PAGE_WATCH_READ)
+        debugger->watchRead(address, value);
+    return value;
+}
+
+void Memory::writeSlow(word address, byte b)
+{
+    word_t a = address.value();
+    byte flags = pageFlags[a >> 8];
+    if (flags & PAGE_ECHO) {
+        set<byte>(a - 0x2000, b);
         return;
     }
-    rom[address.value()] = b; 
-    debugger->handleMemoryAccess(this, address, true);
 
-    if (address == 0xff46)
-        dmaTransfer(b);
-}
+    if (flags & PAGE_READ_ONLY) {
+        // Writes to the MBC registers are the ones worth watching when banking goes wrong
+        if (flags & PAGE_WATCH_WRITE)
+            debugger->watchWrite(address, pages[a >> 8][a & 0xff], b);
+        if (a < 0x8000) {
+            if (cartridge->write(address, b))
+                mapCartridge();
+            // The code after the write may be in another bank now
+            if (blockCache)
+                blockCache->stopBlock();
+        }
+        return;
+    }
+    byte old = pages[a >> 8][a & 0xff];
+    pages[a >> 8][a & 0xff] = b;
 
-template <> byte Memory::get<byte>(word address) {
-    debugger->handleMemoryAccess(this, address, false);
-    return rom[address.value()];
-}
+    if (flags & PAGE_SAVE_CLEAN) {
+        // Only the first write after a flush is tracked
+        cartridge->markDirty(ramBank, a & 0x1fff & ~0xff);
+        setPageFlags(a >> 8, PAGE_SAVE_CLEAN, false);
+    }
 
-template <> void Memory::set<word>(word address, word w) {
-    set<byte>(address.value(), w.lo());
-    set<byte>(address.value()+1, w.hi());
-}
+    if (flags & PAGE_WATCH_WRITE)
+        debugger->watchWrite(address, old, b);
+
+    if ((flags & PAGE_CODE) && blockCache)
+        blockCache->handleWrite(address);
+
+    if ((flags & PAGE_TILES) && tileCache)
+        tileCache->invalidate(address);
+
+    if ((flags & PAGE_IO) && ioHandler && a < 0xff80)
+        ioHandler->writeIO(address, b);
 
-template <> word Memory::get<word>(word address) {
-    byte lo = get<byte>(address.value());
-    byte hi = get<byte>(address.value()+1);
-    return word(lo, hi);
+    // IE, IF and registers which reschedule events take effect before the next instruction
+    if ((flags & PAGE_IO) && blockCache && (a < 0xff80 || a == 0xffff))
+        blockCache->stopBlock();
 }
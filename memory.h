@@ -1,17 +1,69 @@
 #ifndef MEMORY_H
 #define MEMORY_H
 
+#include <string.h>
+
 #include "word.h"
 
 class Debugger;
+class BlockCache;
+class TileCache;
+class Cartridge;
+
+/* Receives every access to the IO registers 0xff00-0xff7f */
+class IOHandler
+{
+public:
+    virtual ~IOHandler() {}
+
+    virtual byte readIO(word address) = 0;
+    virtual void writeIO(word address, byte value) = 0;
+};
 
+/* Reasons for a page to leave the direct access path */
+enum PageFlags
+{
+    PAGE_READ_ONLY  = 1 << 0,   /* ROM or absent cartridge RAM, writes go to the MBC */
+    PAGE_IO         = 1 << 1,   /* IO registers, HRAM and IE */
+    PAGE_CODE       = 1 << 2,   /* holds code of cached blocks */
+    PAGE_WATCH_READ = 1 << 3,   /* the debugger watches reads of an address in it */
+    PAGE_WATCH_WRITE = 1 << 4,  /* the debugger watches writes to an address in it */
+    PAGE_SAVE_CLEAN = 1 << 5,   /* battery RAM not written since the last flush */
+    PAGE_TILES      = 1 << 6,   /* tile data, writes invalidate the tile cache */
+    PAGE_ECHO       = 1 << 7    /* echo RAM, accesses go to the work RAM address */
+};
+
+/*
+ * The address space is split into 256 pages of 256 bytes. A page which
+ * needs no special treatment has a direct read and write pointer, so an
+ * access is one table lookup and a load or store. Pages with flags set
+ * have a null pointer for the affected direction and go through
+ * readSlow()/writeSlow(), which call the debugger, block cache and IO
+ * handler.
+ */
 class Memory
 {
 private:
-    byte *rom;
+    static const int PAGE_COUNT = 256;
+
+    byte *ram;
+    byte openBus[256];
+    Cartridge *cartridge;
     Debugger *debugger;
+    BlockCache *blockCache;
+    TileCache *tileCache;
+    IOHandler *ioHandler;
 
-    void dmaTransfer(byte b);
+    byte *pages[PAGE_COUNT];        /* backing storage of each page */
+    byte *readPages[PAGE_COUNT];    /* pages[] or 0 for slow reads */
+    byte *writePages[PAGE_COUNT];   /* pages[] or 0 for slow writes */
+    byte pageFlags[PAGE_COUNT];
+    int lowBank, highBank, ramBank;
+
+    void mapPage(int page);
+    void mapCartridge();
+    byte readSlow(word address);
+    void writeSlow(word address, byte b);
 
 public:
     Memory(const char *file, Debugger *debugger);
@@ -20,7 +72,79 @@ public:
     template <class T> void set(word address, T b);
     template <class T> T get(word address);
 
-    byte & getRef(word address) { return rom[address.value()]; };
+    /* Direct access to the mapped storage, bypassing every handler */
+    byte & getRef(word address) {
+        word_t a = address.value();
+        return pages[a >> 8][a & 0xff];
+    };
+
+    /* Copies 0xa0 bytes from page b to OAM */
+    void dmaTransfer(byte b);
+
+    /* Identifies the ROM or cartridge RAM bank mapped at the address, 0 elsewhere */
+    int bankAt(word address) const {
+        if (address < 0x4000)
+            return lowBank;
+        if (address < 0x8000)
+            return highBank;
+        if (address >= 0xa000 && address < 0xc000)
+            return 0x1000 + ramBank;
+        return 0;
+    };
+
+    void setPageFlags(int page, byte flags, bool enable);
+
+    /* Routes pages with watched addresses through the debugger */
+    void updateWatches();
+
+    /* Writes changed battery RAM back to the save file, call once per frame */
+    void flushSaveRam();
+
+    void setBlockCache(BlockCache *cache) { blockCache = cache; };
+    void setTileCache(TileCache *cache);
+    void setIOHandler(IOHandler *handler) { ioHandler = handler; };
 };
 
+template <> inline byte Memory::get<byte>(word address) {
+    word_t a = address.value();
+    byte *page = readPages[a >> 8];
+    if (page)
+        return page[a & 0xff];
+    return readSlow(address);
+}
+
+template <> inline void Memory::set<byte>(word address, byte b) {
+    word_t a = address.value();
+    byte *page = writePages[a >> 8];
+    if (page)
+        page[a & 0xff] = b;
+    else
+        writeSlow(address, b);
+}
+
+/* Both bytes in one direct page are a single little-endian load or store */
+template <> inline word Memory::get<word>(word address) {
+    word_t a = address.value();
+    byte *page = readPages[a >> 8];
+    if (page && (a & 0xff) != 0xff) {
+        word w;
+        memcpy(&w, page + (a & 0xff), 2);
+        return w;
+    }
+    byte lo = get<byte>(a);
+    byte hi = get<byte>(a+1);
+    return word(lo, hi);
+}
+
+template <> inline void Memory::set<word>(word address, word w) {
+    word_t a = address.value();
+    byte *page = writePages[a >> 8];
+    if (page && (a & 0xff) != 0xff) {
+        memcpy(page + (a & 0xff), &w, 2);
+        return;
+    }
+    set<byte>(a, w.lo());
+    set<byte>(a+1, w.hi());
+}
+
 #endif
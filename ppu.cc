@@ -0,0 +1,289 @@
+#include <cstring>
+
+#include "ppu.h"
+#include "cpu.h"
+#include "memory.h"
+#include "scheduler.h"
+#include "tilecache.h"
+
+static const byte colors[4][3] = {
+    {196, 207, 161},
+    {139, 149, 109},
+    { 77,  83,  60},
+    { 31,  31,  31},
+};
+
+/* Durations in CPU cycles */
+static const int CYCLES_OAM      = 80;
+static const int CYCLES_TRANSFER = 172;
+static const int CYCLES_HBLANK   = 204;
+static const int CYCLES_LINE     = 456;
+static const int CYCLES_FRAME    = 154 * CYCLES_LINE;
+
+/* LCDC bits */
+static const byte LCDC_BG_ENABLE     = 1 << 0;
+static const byte LCDC_OBJ_ENABLE    = 1 << 1;
+static const byte LCDC_OBJ_TALL      = 1 << 2;
+static const byte LCDC_BG_MAP        = 1 << 3;
+static const byte LCDC_TILE_DATA     = 1 << 4;
+static const byte LCDC_WINDOW_ENABLE = 1 << 5;
+static const byte LCDC_WINDOW_MAP    = 1 << 6;
+static const byte LCDC_ENABLE        = 1 << 7;
+
+/* Background and window tiles are numbered from 0x8000 or signed around 0x9000 */
+static inline int bgTile(byte lcdc, byte tile)
+{
+    if (lcdc & LCDC_TILE_DATA)
+        return tile;
+    return 0x100 + (signed_byte)tile;
+}
+
+void shadesToRGB(const byte *shades, byte *rgb, int count)
+{
+    for (int i = 0; i < count; ++i)
+        memcpy(rgb + i * 3, colors[shades[i] & 3], 3);
+}
+
+void shadesToRGBA(const byte *shades, uint32_t *rgba, int count)
+{
+    // Built byte by byte, so the words are R, G, B, A in memory on any host
+    uint32_t table[4];
+    for (int i = 0; i < 4; ++i) {
+        byte c[4] = { colors[i][0], colors[i][1], colors[i][2], 0xff };
+        memcpy(&table[i], c, 4);
+    }
+    for (int i = 0; i < count; ++i)
+        rgba[i] = table[shades[i] & 3];
+}
+
+PPU::PPU(Memory *memory, CPU *cpu, Scheduler *scheduler)
+    : memory(memory), cpu(cpu), scheduler(scheduler),
+      enabled(true), line(0), mode(LCD_OAM), windowLine(0)
+{
+    memset(screen, 0, sizeof(screen));
+    tiles = new TileCache(&memory->getRef(0x8000));
+    memory->setTileCache(tiles);
+
+    // Register values left behind by the boot ROM
+    memory->getRef(0xff40) = 0x91;
+    memory->getRef(0xff47) = 0xfc;
+    memory->getRef(0xff48) = 0xff;
+    memory->getRef(0xff49) = 0xff;
+
+    memory->getRef(0xff41) = (memory->getRef(0xff41) & 0x78) | LCD_OAM;
+    setLine(0);
+    scheduler->schedule(EVENT_LCD, CYCLES_OAM);
+}
+
+PPU::~PPU()
+{
+    memory->setTileCache(0);
+    delete tiles;
+}
+
+void PPU::setMode(LcdMode m)
+{
+    static const byte modeInterrupts[4] = { 1 << 3, 1 << 4, 1 << 5, 0 };
+
+    mode = m;
+    byte &stat = memory->getRef(0xff41);
+    stat = (stat & ~0x03) | m;
+    if (stat & modeInterrupts[m])
+        cpu->requestInterrupt(INT_LCDSTAT);
+}
+
+void PPU::setLine(byte ly)
+{
+    line = ly;
+    memory->getRef(0xff44) = ly;
+
+    byte &stat = memory->getRef(0xff41);
+    if (ly == memory->getRef(0xff45)) {
+        stat |= 1 << 2;
+        if (stat & (1 << 6))
+            cpu->requestInterrupt(INT_LCDSTAT);
+    } else {
+        stat &= ~(1 << 2);
+    }
+}
+
+bool PPU::event(uint64_t when)
+{
+    if (!enabled) {
+        // The display is blank, but frames keep their pace
+        scheduler->schedule(EVENT_LCD, when + CYCLES_FRAME);
+        return true;
+    }
+
+    switch (mode) {
+    case LCD_OAM:
+        setMode(LCD_TRANSFER);
+        scheduler->schedule(EVENT_LCD, when + CYCLES_TRANSFER);
+        break;
+    case LCD_TRANSFER:
+        renderLine();
+        setMode(LCD_HBLANK);
+        scheduler->schedule(EVENT_LCD, when + CYCLES_HBLANK);
+        break;
+    case LCD_HBLANK:
+        setLine(line + 1);
+        if (line == GB_DISPLAY_HEIGHT) {
+            setMode(LCD_VBLANK);
+            cpu->requestInterrupt(INT_VBLANK);
+            scheduler->schedule(EVENT_LCD, when + CYCLES_LINE);
+            return true;
+        }
+        setMode(LCD_OAM);
+        scheduler->schedule(EVENT_LCD, when + CYCLES_OAM);
+        break;
+    case LCD_VBLANK:
+        if (line == 153) {
+            windowLine = 0;
+            setLine(0);
+            setMode(LCD_OAM);
+            scheduler->schedule(EVENT_LCD, when + CYCLES_OAM);
+        } else {
+            setLine(line + 1);
+            scheduler->schedule(EVENT_LCD, when + CYCLES_LINE);
+        }
+        break;
+    }
+    return false;
+}
+
+void PPU::writeRegister(word address, byte value, uint64_t now)
+{
+    switch (address.value()) {
+    case 0xff40:
+        if ((value & LCDC_ENABLE) && !enabled) {
+            // A new frame starts at line 0
+            enabled = true;
+            windowLine = 0;
+            setLine(0);
+            setMode(LCD_OAM);
+            scheduler->schedule(EVENT_LCD, now + CYCLES_OAM);
+        } else if (!(value & LCDC_ENABLE) && enabled) {
+            enabled = false;
+            mode = LCD_HBLANK;
+            memory->getRef(0xff41) &= ~0x03;
+            setLine(0);
+            memset(screen, 0, sizeof(screen));
+            scheduler->schedule(EVENT_LCD, now + CYCLES_FRAME);
+        }
+        break;
+    case 0xff41:
+        // Mode and coincidence bits are read-only
+        memory->getRef(address) = (value & 0x78)
+                                | (line == memory->getRef(0xff45) ? 1 << 2 : 0)
+                                | mode;
+        break;
+    case 0xff44:
+        memory->getRef(address) = line;
+        break;
+    case 0xff45:
+        setLine(line);
+        break;
+    }
+}
+
+/* Copies the color indices of map row y from pixel px of the map on, starting at screen column x */
+void PPU::renderTiles(byte *indices, int x, int px, byte y, int map, byte lcdc)
+{
+    const byte *vram = &memory->getRef(0x8000);
+    const byte *tileMap = vram + map + (y >> 3) * 32;
+
+    while (x < GB_DISPLAY_WIDTH) {
+        int offset = px & 7;
+        int count = 8 - offset;
+        if (count > GB_DISPLAY_WIDTH - x)
+            count = GB_DISPLAY_WIDTH - x;
+
+        const byte *row = tiles->row(bgTile(lcdc, tileMap[(px >> 3) & 31]), y & 7, false);
+        memcpy(indices + x, row + offset, count);
+        x += count;
+        px += count;
+    }
+}
+
+/*
+ * Like the hardware, takes the first ten sprites in OAM order which cover
+ * the line, whether they are visible or not. Among those, the one with the
+ * smaller X, then the lower OAM index, owns a pixel where it is opaque,
+ * even if it is behind the background there.
+ */
+void PPU::renderSprites(byte *shades, const byte *indices, byte lcdc)
+{
+    int height = (lcdc & LCDC_OBJ_TALL) ? 16 : 8;
+    const byte *oam = &memory->getRef(0xfe00);
+    const byte *selected[MAX_LINE_SPRITES];
+    int count = 0;
+
+    for (int i = 0; i < 40 && count < MAX_LINE_SPRITES; ++i) {
+        const byte *sprite = oam + i * 4;
+        int y = line - (sprite[0] - 16);
+        if (y < 0 || y >= height)
+            continue;
+
+        // Insert sorted by X, after sprites with the same X
+        int j = count++;
+        for (; j > 0 && selected[j - 1][1] > sprite[1]; --j)
+            selected[j] = selected[j - 1];
+        selected[j] = sprite;
+    }
+
+    byte drawn[GB_DISPLAY_WIDTH];
+    memset(drawn, 0, sizeof(drawn));
+
+    for (int i = 0; i < count; ++i) {
+        const byte *sprite = selected[i];
+        byte attr = sprite[3];
+        int y = line - (sprite[0] - 16);
+        if (attr & 0x40)
+            y = height - 1 - y;
+
+        byte tile = height == 16 ? sprite[2] & 0xfe : sprite[2];
+        const byte *row = tiles->row(tile + (y >> 3), y & 7, attr & 0x20);
+        byte obp = memory->getRef((attr & 0x10) ? 0xff49 : 0xff48);
+
+        int left = sprite[1] - 8;
+        for (int x = 0; x < 8; ++x) {
+            int sx = left + x;
+            if (sx < 0 || sx >= GB_DISPLAY_WIDTH || !row[x] || drawn[sx])
+                continue;
+            drawn[sx] = 1;
+            if (!(attr & 0x80) || !indices[sx])
+                shades[sx] = (obp >> (row[x] * 2)) & 3;
+        }
+    }
+}
+
+void PPU::renderLine()
+{
+    byte lcdc = memory->getRef(0xff40);
+    byte bgp = memory->getRef(0xff47);
+    byte *shades = screen + line * GB_DISPLAY_WIDTH;
+    byte indices[GB_DISPLAY_WIDTH];
+
+    // Background, then the window on top of it; both stay white when disabled
+    memset(indices, 0, sizeof(indices));
+    if (lcdc & LCDC_BG_ENABLE) {
+        int map = (lcdc & LCDC_BG_MAP) ? 0x1c00 : 0x1800;
+        byte y = line + memory->getRef(0xff42);
+        renderTiles(indices, 0, memory->getRef(0xff43), y, map, lcdc);
+
+        int wx = memory->getRef(0xff4b) - 7;
+        if ((lcdc & LCDC_WINDOW_ENABLE) && line >= memory->getRef(0xff4a) && wx < GB_DISPLAY_WIDTH) {
+            map = (lcdc & LCDC_WINDOW_MAP) ? 0x1c00 : 0x1800;
+            renderTiles(indices, wx < 0 ? 0 : wx, wx < 0 ? -wx : 0, windowLine++, map, lcdc);
+        }
+    }
+
+    byte palette[4];
+    for (int i = 0; i < 4; ++i)
+        palette[i] = (bgp >> (i * 2)) & 3;
+    for (int x = 0; x < GB_DISPLAY_WIDTH; ++x)
+        shades[x] = palette[indices[x]];
+
+    if (lcdc & LCDC_OBJ_ENABLE)
+        renderSprites(shades, indices, lcdc);
+}
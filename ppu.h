@@ -0,0 +1,72 @@
+#ifndef PPU_H
+#define PPU_H
+
+#include "word.h"
+
+const byte GB_DISPLAY_WIDTH  = 160;
+const byte GB_DISPLAY_HEIGHT = 144;
+
+enum LcdMode
+{
+    LCD_HBLANK    = 0,
+    LCD_VBLANK    = 1,
+    LCD_OAM       = 2,
+    LCD_TRANSFER  = 3
+};
+
+/*
+ * Frames hold one shade index (0 lightest to 3 darkest) per pixel, the
+ * palettes are already applied. Front ends convert a frame to colors only
+ * when they present it.
+ */
+void shadesToRGB(const byte *shades, byte *rgb, int count);
+void shadesToRGBA(const byte *shades, uint32_t *rgba, int count);
+
+class CPU;
+class Memory;
+class Scheduler;
+class TileCache;
+
+/*
+ * The LCD controller. It steps through the modes of each line as EVENT_LCD
+ * events and draws a visible line when its transfer mode ends, so changes
+ * to LCDC, the scroll and window positions or the palettes between lines
+ * show up on screen.
+ */
+class PPU
+{
+private:
+    static const int MAX_LINE_SPRITES = 10;
+
+    Memory *memory;
+    CPU *cpu;
+    Scheduler *scheduler;
+    TileCache *tiles;
+
+    byte screen[GB_DISPLAY_WIDTH * GB_DISPLAY_HEIGHT];
+
+    bool enabled;
+    byte line;
+    LcdMode mode;
+    byte windowLine;    /* window rows drawn so far in this frame */
+
+    void setMode(LcdMode mode);
+    void setLine(byte ly);
+    void renderTiles(byte *indices, int x, int px, byte y, int map, byte lcdc);
+    void renderSprites(byte *shades, const byte *indices, byte lcdc);
+    void renderLine();
+
+public:
+    PPU(Memory *memory, CPU *cpu, Scheduler *scheduler);
+    ~PPU();
+
+    /* Handles EVENT_LCD, returns true when a frame is complete */
+    bool event(uint64_t when);
+
+    /* Called after the CPU wrote LCDC, STAT, LY or LYC */
+    void writeRegister(word address, byte value, uint64_t now);
+
+    const byte *getScreen() const { return screen; }
+};
+
+#endif
@@ -0,0 +1,281 @@
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__linux__)
+#include <sys/mman.h>
+#define RECOMPILER_X86_64
+#endif
+
+#include "recompiler.h"
+#include "blockcache.h"
+#include "cpu.h"
+#include "memory.h"
+
+static const size_t CODE_BUFFER_SIZE = 4 * 1024 * 1024;
+
+bool Recompiler::supported()
+{
+#ifdef RECOMPILER_X86_64
+    return true;
+#else
+    return false;
+#endif
+}
+
+Recompiler::Recompiler(CPU *cpu) : cpu(cpu), code(0), size(0), used(0), out(0), end(0)
+{
+#ifdef RECOMPILER_X86_64
+    void *p = mmap(0, CODE_BUFFER_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p != MAP_FAILED) {
+        code = (byte *)p;
+        size = CODE_BUFFER_SIZE;
+    }
+#endif
+}
+
+Recompiler::~Recompiler()
+{
+#ifdef RECOMPILER_X86_64
+    if (code)
+        munmap(code, size);
+#endif
+}
+
+void Recompiler::emit8(byte b)
+{
+    *out++ = b;
+}
+
+void Recompiler::emit16(word_t w)
+{
+    memcpy(out, &w, 2);
+    out += 2;
+}
+
+void Recompiler::emit32(uint32_t d)
+{
+    memcpy(out, &d, 4);
+    out += 4;
+}
+
+void Recompiler::emit64(uint64_t q)
+{
+    memcpy(out, &q, 8);
+    out += 8;
+}
+
+int32_t Recompiler::offsetOf(const void *field) const
+{
+    return (int32_t)((const char *)field - (const char *)cpu);
+}
+
+int32_t Recompiler::registerOffset(int r, int hi) const
+{
+    return offsetOf(&cpu->registerBank[r]) + hi;
+}
+
+void Recompiler::emitCall(uint64_t function)
+{
+    emit8(0x48); emit8(0x89); emit8(0xdf);      // mov rdi, rbx
+    emit8(0x48); emit8(0xb8); emit64(function); // mov rax, imm64
+    emit8(0xff); emit8(0xd0);                   // call rax
+}
+
+void Recompiler::emitSetPC(word_t pc)
+{
+    emit8(0x66); emit8(0xc7); emit8(0x83);      // mov word [rbx+disp32], imm16
+    emit32(registerOffset(REG_PC, 0));
+    emit16(pc);
+}
+
+void Recompiler::emitCycles(int cycles)
+{
+    if (!cycles)
+        return;
+    emit8(0x48); emit8(0x81); emit8(0x83);      // add qword [rbx+disp32], imm32
+    emit32(offsetOf(&cpu->cycles));
+    emit32(cycles);
+}
+
+/* Returns from the block if the call before stopped it, counting the cycles of that call */
+void Recompiler::emitStopCheck(int cycles)
+{
+    emit8(0x80); emit8(0xbb);                   // cmp byte [rbx+disp32], 0
+    emit32(offsetOf(&cpu->blockStopped));
+    emit8(0x00);
+    emit8(0x74); emit8(0);                      // je running
+    byte *running = out;
+
+    emitCycles(cycles);
+    emit8(0x5b);                                // pop rbx
+    emit8(0xc3);                                // ret
+
+    running[-1] = out - running;
+}
+
+/* Operand encoding of the r fields in the opcode, -1 for (HL) */
+static const int registerNumbers[8][2] = {
+    { REG_BC, 1 }, { REG_BC, 0 }, { REG_DE, 1 }, { REG_DE, 0 },
+    { REG_HL, 1 }, { REG_HL, 0 }, { -1, 0 },     { REG_AF, 1 }
+};
+
+static const int registerPairs[4] = { REG_BC, REG_DE, REG_HL, REG_SP };
+
+bool Recompiler::emitNative(word_t address, byte code, bool &pcSet)
+{
+    Memory *memory = cpu->memory;
+    pcSet = false;
+
+    if (code == 0x00) {
+        // NOP
+        return true;
+    }
+
+    if (code >= 0x40 && code < 0x80 && code != 0x76) {
+        // LD r,r
+        const int *dst = registerNumbers[(code >> 3) & 7];
+        const int *src = registerNumbers[code & 7];
+        if (dst[0] < 0 || src[0] < 0)
+            return false;
+        emit8(0x8a); emit8(0x83); emit32(registerOffset(src[0], src[1]));  // mov al, [rbx+src]
+        emit8(0x88); emit8(0x83); emit32(registerOffset(dst[0], dst[1]));  // mov [rbx+dst], al
+        return true;
+    }
+
+    if ((code & 0xc7) == 0x06) {
+        // LD r,d8
+        const int *dst = registerNumbers[(code >> 3) & 7];
+        if (dst[0] < 0)
+            return false;
+        emit8(0xc6); emit8(0x83); emit32(registerOffset(dst[0], dst[1]));  // mov byte [rbx+dst], imm8
+        emit8(memory->getRef(address + 1));
+        return true;
+    }
+
+    if ((code & 0xcf) == 0x01) {
+        // LD rr,d16
+        word imm(memory->getRef(address + 1), memory->getRef(address + 2));
+        emit8(0x66); emit8(0xc7); emit8(0x83);                             // mov word [rbx+rr], imm16
+        emit32(registerOffset(registerPairs[code >> 4], 0));
+        emit16(imm.value());
+        return true;
+    }
+
+    if ((code & 0xcf) == 0x03 || (code & 0xcf) == 0x0b) {
+        // INC rr, DEC rr
+        emit8(0x66); emit8(0xff); emit8((code & 0x08) ? 0x8b : 0x83);     // inc/dec word [rbx+rr]
+        emit32(registerOffset(registerPairs[code >> 4], 0));
+        return true;
+    }
+
+    if (code == 0xc3) {
+        // JP a16
+        emitSetPC(word(memory->getRef(address + 1), memory->getRef(address + 2)).value());
+        pcSet = true;
+        return true;
+    }
+
+    if (code == 0x18) {
+        // JR r8
+        emitSetPC(address + 2 + (signed_byte)memory->getRef(address + 1));
+        pcSet = true;
+        return true;
+    }
+
+    return false;
+}
+
+void Recompiler::emitConditional(word_t address, byte code, const MicroOp &op)
+{
+    Memory *memory = cpu->memory;
+
+    emitCall((uint64_t)(uintptr_t)op.condition);
+    emit8(0x84); emit8(0xc0);                   // test al, al
+    emit8(0x0f); emit8(0x84); emit32(0);        // jz not_taken
+    byte *notTaken = out;
+
+    if ((code & 0xe7) == 0x20) {
+        // JR cc,r8
+        emitSetPC(address + 2 + (signed_byte)memory->getRef(address + 1));
+    } else if ((code & 0xe7) == 0xc2) {
+        // JP cc,a16
+        emitSetPC(word(memory->getRef(address + 1), memory->getRef(address + 2)).value());
+    } else {
+        emitSetPC(address + op.prefix);
+        emitCall((uint64_t)(uintptr_t)op.execute);
+    }
+    emitCycles(op.cycles0);
+    emit8(0xe9); emit32(0);                     // jmp done
+    byte *done = out;
+
+    int32_t rel = out - notTaken;
+    memcpy(notTaken - 4, &rel, 4);
+    emitSetPC(address + op.length);
+    emitCycles(op.cycles1);
+
+    rel = out - done;
+    memcpy(done - 4, &rel, 4);
+}
+
+NativeBlock Recompiler::compile(const Block *block)
+{
+#ifdef RECOMPILER_X86_64
+    if (!code || block->start >= 0x8000 || full())
+        return 0;
+
+    // Worst case is a call sequence of 57 bytes per micro-op
+    if ((block->ops.size() + 4) * 64 > size - used)
+        return 0;
+
+    byte *start = code + used;
+    out = start;
+    end = code + size;
+
+    emit8(0x53);                                // push rbx
+    emit8(0x48); emit8(0x89); emit8(0xfb);      // mov rbx, rdi
+
+    Memory *memory = cpu->memory;
+    word_t address = block->start.value();
+    bool pcSet = false;
+    int pending = 0;                            // cycles of ops run but not yet counted
+    for (size_t i = 0; i < block->ops.size(); ++i) {
+        const MicroOp &op = block->ops[i];
+        byte opcode = memory->getRef(address);
+
+        if (op.condition) {
+            emitCycles(pending);
+            pending = 0;
+            emitConditional(address, opcode, op);
+            pcSet = true;
+        } else if (emitNative(address, opcode, pcSet)) {
+            pending += op.cycles0;
+        } else {
+            // Memory and IO accesses see the cycles of everything before them
+            emitCycles(pending);
+            emitSetPC(address + op.prefix);
+            emitCall((uint64_t)(uintptr_t)op.execute);
+            pending = op.cycles0;
+            pcSet = true;
+
+            // The call has set pc past the instruction already
+            if (i + 1 < block->ops.size())
+                emitStopCheck(pending);
+        }
+
+        address += op.length;
+    }
+    emitCycles(pending);
+
+    // The last instruction fell through without touching pc
+    if (!pcSet)
+        emitSetPC(address);
+
+    emit8(0x5b);                                // pop rbx
+    emit8(0xc3);                                // ret
+
+    used = out - code;
+    return (NativeBlock)start;
+#else
+    return 0;
+#endif
+}
@@ -0,0 +1,61 @@
+#ifndef RECOMPILER_H
+#define RECOMPILER_H
+
+#include <stddef.h>
+
+#include "word.h"
+
+class CPU;
+struct Block;
+struct MicroOp;
+
+typedef void (*NativeBlock)(CPU *cpu);
+
+/*
+ * Translates ROM-resident blocks of the BlockCache into x86-64 code.
+ * Register moves, immediate loads, 16-bit INC/DEC and jumps are emitted
+ * natively against the CPU registerBank; every other instruction calls its
+ * execute() function, so memory and IO accesses run through the same code
+ * as in the interpreter. The cycles of native instructions are counted
+ * before the next call, so every call sees the cycle counter the
+ * interpreter would show it. Like interpreted blocks, native blocks only
+ * check interrupts at their boundaries, and return early when a call
+ * stopped the block.
+ */
+class Recompiler
+{
+private:
+    CPU *cpu;
+    byte *code;
+    size_t size;
+    size_t used;
+
+    byte *out;
+    byte *end;
+
+    void emit8(byte b);
+    void emit16(word_t w);
+    void emit32(uint32_t d);
+    void emit64(uint64_t q);
+    void emitCall(uint64_t function);
+    void emitSetPC(word_t pc);
+    int32_t offsetOf(const void *field) const;
+    int32_t registerOffset(int r, int hi) const;
+    void emitCycles(int cycles);
+    void emitStopCheck(int cycles);
+    bool emitNative(word_t address, byte code, bool &pcSet);
+    void emitConditional(word_t address, byte code, const MicroOp &op);
+
+public:
+    static bool supported();
+
+    Recompiler(CPU *cpu);
+    ~Recompiler();
+
+    /* Returns 0 when the block is not in ROM or the code buffer is full */
+    NativeBlock compile(const Block *block);
+    bool full() const { return size - used < 4096; };
+    void reset() { used = 0; };
+};
+
+#endif
@@ -4,109 +4,131 @@
 #include "cpu.h"
 #include "memory.h"
 
-template <class T>
-class Reference
-{
-public:
-    virtual ~Reference() {};
-    virtual T get() = 0;
-    virtual void set(T v) = 0;
-};
+/*
+ * Instruction operands are stateless policies rather than objects, so the
+ * compiler can inline every access. Operands which fetch from the
+ * instruction stream advance pc themselves.
+ */
 
-template <class T>
-class RegisterReference : public Reference<T>
+template <int R>
+struct Register16
 {
-private:
-    T &r;
-public:
-    RegisterReference(T &r) : r(r) {};
-    virtual T get() { return r; };
-    virtual void set(T v) { r = v; };
+    typedef word type;
+    static inline word get(CPU *cpu) {
+        if (R == REG_AF)
+            cpu->materializeFlags();
+        return cpu->registerBank[R];
+    };
+    static inline void set(CPU *cpu, word v) {
+        if (R == REG_AF)
+            cpu->discardFlags();
+        cpu->registerBank[R] = v;
+    };
 };
 
-template <class T>
-class MemoryReference : public Reference<T>
+template <int R, bool Hi>
+struct Register8
 {
-private:
-    CPU *cpu;
-    word &r;
-public:
-    MemoryReference(CPU *cpu, word &r) : cpu(cpu), r(r) {};
-    virtual T get() {
-        return cpu->memory->get<T>(r);
+    typedef byte type;
+    static inline byte get(CPU *cpu) {
+        if (R == REG_AF && !Hi)
+            cpu->materializeFlags();
+        return Hi ? cpu->registerBank[R].hi() : cpu->registerBank[R].lo();
     };
-    virtual void set(T v) {
-        cpu->memory->set<T>(r, v);
+    static inline void set(CPU *cpu, byte v) {
+        if (R == REG_AF && !Hi)
+            cpu->discardFlags();
+        if (Hi)
+            cpu->registerBank[R].sethi(v);
+        else
+            cpu->registerBank[R].setlo(v);
     };
 };
 
-template <class T>
-class Memory_HL_Reference : public Reference<T>
+template <int R, class T = byte>
+struct Memory_Register
+{
+    typedef T type;
+    static inline T get(CPU *cpu) { return cpu->memory->get<T>(cpu->registerBank[R]); };
+    static inline void set(CPU *cpu, T v) { cpu->memory->set<T>(cpu->registerBank[R], v); };
+};
+
+template <int Add>
+struct Memory_HL
 {
-private:
-    CPU *cpu;
-    word &r;
-    word add;
-public:
-    Memory_HL_Reference(CPU *cpu, word &r, word add) : cpu(cpu), r(r), add(add) {};
-    virtual T get() {
-        T v = cpu->memory->get<T>(r);
-        r += add;
+    typedef byte type;
+    static inline byte get(CPU *cpu) {
+        byte v = cpu->memory->get<byte>(cpu->registerBank[REG_HL]);
+        cpu->registerBank[REG_HL] += word_t(Add);
         return v;
     };
-    virtual void set(T v) {
-        cpu->memory->set<T>(r, v);
-        r += add;
+    static inline void set(CPU *cpu, byte v) {
+        cpu->memory->set<byte>(cpu->registerBank[REG_HL], v);
+        cpu->registerBank[REG_HL] += word_t(Add);
     };
 };
 
 template <class T>
-class Memory_a8_Reference : public Reference<T>
+struct Immediate
 {
-private:
-    CPU *cpu;
-    word &r;
-public:
-    Memory_a8_Reference(CPU *cpu, word &r): cpu(cpu), r(r) {};
-    virtual T get() {
-        return cpu->memory->get<T>( word(cpu->memory->get<byte>(r), 0xff));
-    };
-    virtual void set(T v) {
-        cpu->memory->set<T>(word(cpu->memory->get<byte>(r), 0xff), v);
+    typedef T type;
+    static inline T get(CPU *cpu) {
+        T v = cpu->memory->get<T>(cpu->registerBank[REG_PC]);
+        cpu->registerBank[REG_PC] += word_t(sizeof(T));
+        return v;
     };
 };
 
 template <class T>
-class Memory_a16_Reference : public Reference<T>
+struct Memory_a8
 {
-private:
-    CPU *cpu;
-    word &r;
-public:
-    Memory_a16_Reference(CPU *cpu, word &r): cpu(cpu), r(r) {};
-    virtual T get() {
-        return cpu->memory->get<T>( cpu->memory->get<word>(r) );
-    };
-    virtual void set(T v) {
-        cpu->memory->set<T>( cpu->memory->get<word>(r), v );
-    };
+    typedef T type;
+    static inline T get(CPU *cpu) { return cpu->memory->get<T>(word(Immediate<byte>::get(cpu), 0xff)); };
+    static inline void set(CPU *cpu, T v) { cpu->memory->set<T>(word(Immediate<byte>::get(cpu), 0xff), v); };
 };
 
-
 template <class T>
-class Memory_SingleRegister_Reference : public Reference<T>
+struct Memory_a16
+{
+    typedef T type;
+    static inline T get(CPU *cpu) { return cpu->memory->get<T>(Immediate<word>::get(cpu)); };
+    static inline void set(CPU *cpu, T v) { cpu->memory->set<T>(Immediate<word>::get(cpu), v); };
+};
+
+/* The stack moves whole words, so pushes and pops take the 16-bit path */
+struct Stack
 {
-private:
-    CPU *cpu;
-    byte &r;
-public:
-    Memory_SingleRegister_Reference(CPU *cpu, byte &r): cpu(cpu), r(r) {};
-    virtual T get() {
-        return cpu->memory->get<T>( word(r, 0xff));
+    static inline void push(CPU *cpu, word v) {
+        cpu->sp = cpu->sp.value() - 2;
+        cpu->memory->set<word>(cpu->sp, v);
     };
-    virtual void set(T v) {
-        cpu->memory->set<T>(word(r, 0xff), v);
+    static inline word pop(CPU *cpu) {
+        word v = cpu->memory->get<word>(cpu->sp);
+        cpu->sp = cpu->sp.value() + 2;
+        return v;
     };
 };
 
+struct Memory_C
+{
+    typedef byte type;
+    static inline byte get(CPU *cpu) { return cpu->memory->get<byte>(word(cpu->registerBank[REG_BC].lo(), 0xff)); };
+    static inline void set(CPU *cpu, byte v) { cpu->memory->set<byte>(word(cpu->registerBank[REG_BC].lo(), 0xff), v); };
+};
+
+typedef Register8<REG_AF, true>  Reg_A;
+typedef Register8<REG_AF, false> Reg_F;
+typedef Register8<REG_BC, true>  Reg_B;
+typedef Register8<REG_BC, false> Reg_C;
+typedef Register8<REG_DE, true>  Reg_D;
+typedef Register8<REG_DE, false> Reg_E;
+typedef Register8<REG_HL, true>  Reg_H;
+typedef Register8<REG_HL, false> Reg_L;
+
+typedef Register16<REG_SP> Reg_SP;
+typedef Register16<REG_AF> Reg_AF;
+typedef Register16<REG_BC> Reg_BC;
+typedef Register16<REG_DE> Reg_DE;
+typedef Register16<REG_HL> Reg_HL;
+
 #endif
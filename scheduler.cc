@@ -0,0 +1,43 @@
+#include "scheduler.h"
+
+Scheduler::Scheduler() : next(NEVER)
+{
+    for (int i = 0; i < EVENT_COUNT; ++i)
+        deadlines[i] = NEVER;
+}
+
+void Scheduler::update()
+{
+    next = NEVER;
+    for (int i = 0; i < EVENT_COUNT; ++i)
+        if (deadlines[i] < next)
+            next = deadlines[i];
+}
+
+void Scheduler::schedule(Event event, uint64_t when)
+{
+    deadlines[event] = when;
+    update();
+}
+
+void Scheduler::cancel(Event event)
+{
+    deadlines[event] = NEVER;
+    update();
+}
+
+Event Scheduler::pop(uint64_t now, uint64_t &when)
+{
+    if (next > now)
+        return EVENT_NONE;
+
+    int earliest = 0;
+    for (int i = 1; i < EVENT_COUNT; ++i)
+        if (deadlines[i] < deadlines[earliest])
+            earliest = i;
+
+    when = deadlines[earliest];
+    deadlines[earliest] = NEVER;
+    update();
+    return (Event)earliest;
+}
@@ -0,0 +1,45 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdint.h>
+
+enum Event
+{
+    EVENT_NONE    = -1,
+    EVENT_LCD     = 0,
+    EVENT_TIMER   = 1,
+    EVENT_SERIAL  = 2,
+    EVENT_DMA     = 3,
+    EVENT_COUNT   = 4
+};
+
+/*
+ * Deadlines of the hardware events, as absolute CPU cycle timestamps. There
+ * are only a handful of event types and each is pending at most once, so a
+ * fixed array with a cached minimum is all the queue we need. The CPU runs
+ * freely until nextDeadline().
+ */
+class Scheduler
+{
+private:
+    uint64_t deadlines[EVENT_COUNT];
+    uint64_t next;
+
+    void update();
+
+public:
+    static const uint64_t NEVER = ~(uint64_t)0;
+
+    Scheduler();
+
+    void schedule(Event event, uint64_t when);
+    void cancel(Event event);
+
+    uint64_t deadline(Event event) const { return deadlines[event]; };
+    uint64_t nextDeadline() const { return next; };
+
+    /* Removes the earliest event due at now, EVENT_NONE if there is none */
+    Event pop(uint64_t now, uint64_t &when);
+};
+
+#endif
@@ -0,0 +1,71 @@
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <thread>
+
+#include "testrom.h"
+#include "emulatorthread.h"
+
+static bool finished = false;
+
+/* The debugger must not end the program under the front end */
+static void exitedEarly()
+{
+    if (!finished) {
+        fprintf(stderr, "exit() called before the test finished\n");
+        _exit(1);
+    }
+}
+
+/*
+ * Runs ten frames, then hits an unknown opcode. The prompt finds no input
+ * and quits, which has to stop the thread and leave the teardown to the
+ * front end, while it keeps taking frames and stats.
+ */
+int main()
+{
+    TestRom rom;
+    rom.emit({ 0x0e, 0x0a });                   // LD C,10
+    size_t loop = rom.here();
+    for (byte line = 0x90; line <= 0x91; ++line) {
+        size_t wait = rom.here();
+        rom.emit({ 0xf0, 0x44, 0xfe, line });   // LDH A,(44); CP line
+        rom.emit({ 0x20, (byte)(wait - (rom.here() + 2)) });   // JR NZ,wait
+    }
+    rom.emit(0x0d);                             // DEC C
+    rom.emit({ 0x20, (byte)(loop - (rom.here() + 2)) });   // JR NZ,loop
+    rom.emit(0xd3);                             // unused opcode
+
+    if (!freopen("/dev/null", "r", stdin))
+        return 2;
+    atexit(exitedEarly);
+
+    GameBoy *gb = new GameBoy(rom.save("emulatorthread_quit").c_str());
+    gb->getDebugger()->stepMode = false;
+    EmulatorThread *emulator = new EmulatorThread(gb);
+    emulator->setTurbo(true);
+    emulator->start();
+
+    // Takes what the thread published before it stopped, too
+    int frames = 0;
+    for (int i = 0; i < 5000; ++i) {
+        double fps, speed;
+        emulator->takeStats(fps, speed);
+        if (emulator->hasFrame()) {
+            emulator->latestFrame();
+            ++frames;
+        }
+        if (emulator->isQuitRequested())
+            break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    CHECK(emulator->isQuitRequested());
+    CHECK(frames > 0);
+
+    delete emulator;
+    delete gb;
+    finished = true;
+
+    return testResult("emulatorthread");
+}
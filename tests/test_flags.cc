@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "testrom.h"
+
+static const byte values[] = { 0x00, 0x01, 0x0f, 0x10, 0x7f, 0x80, 0x99, 0xff };
+static const int VALUE_COUNT = sizeof(values) / sizeof(values[0]);
+
+/* PUSH AF; POP DE; sends F, then A if asked */
+static void sendFlags(TestRom &rom, bool alsoA = false)
+{
+    rom.emit({ 0xf5, 0xd1, 0x7b }).sendA();     // PUSH AF; POP DE; LD A,E
+    if (alsoA)
+        rom.emit(0x7a).sendA();                 // LD A,D
+}
+
+/*
+ * Branches on Z and C right after an ALU operation and records the taken
+ * branches in C and D, then sends them together with F.
+ */
+static void sendBranches(TestRom &rom)
+{
+    rom.emit({ 0x0e, 0x00, 0x16, 0x00 });       // LD C,0; LD D,0
+    rom.emit({ 0x20, 0x02, 0x0e, 0x01 });       // JR NZ,+2; LD C,1
+    rom.emit({ 0x30, 0x02, 0x16, 0x01 });       // JR NC,+2; LD D,1
+    rom.emit({ 0xf5, 0xe1 });                   // PUSH AF; POP HL
+    rom.emit(0x79).sendA();                     // LD A,C
+    rom.emit(0x7a).sendA();                     // LD A,D
+    rom.emit(0x7d).sendA();                     // LD A,L
+}
+
+/*
+ * Runs the ALU operations whose flags are deferred over pairs of operands
+ * and sends what software can observe of the flags: F pushed to the stack,
+ * DAA, conditional jumps after INC and DEC, and flags loaded by POP AF
+ * while an operation was still pending.
+ */
+static std::string flagsRom()
+{
+    TestRom rom;
+    rom.emit({ 0x3e, 0x15, 0xc6, 0x27, 0x27 }).sendA();    // LD A,15; ADD A,27; DAA
+    rom.emit({ 0x3e, 0x99, 0xc6, 0x01, 0x27 }).sendA();    // LD A,99; ADD A,1; DAA
+
+    static const byte operations[] = { 0xc6, 0xd6, 0xde, 0xfe, 0xe6, 0xf6, 0xee };   // ADD SUB SBC CP AND OR XOR
+    for (int i = 0; i < VALUE_COUNT; ++i) {
+        for (int j = 0; j < VALUE_COUNT; ++j) {
+            for (size_t op = 0; op < sizeof(operations); ++op) {
+                // Alternate the incoming carry for SBC
+                rom.emit((i + j) & 1 ? 0x37 : 0xa7);            // SCF or AND A
+                rom.emit({ 0x3e, values[i], operations[op], values[j] });
+                sendFlags(rom);
+                if (operations[op] == 0xc6 || operations[op] == 0xd6) {
+                    rom.emit({ 0x3e, values[i], operations[op], values[j], 0x27 });   // DAA
+                    sendFlags(rom, true);
+                }
+            }
+        }
+    }
+
+    for (int i = 0; i < VALUE_COUNT; ++i) {
+        // INC and DEC leave the carry alone
+        rom.emit({ 0x37, 0x06, values[i], 0x04 });              // SCF; LD B,v; INC B
+        sendBranches(rom);
+        rom.emit({ 0xa7, 0x06, values[i], 0x05 });              // AND A; LD B,v; DEC B
+        sendBranches(rom);
+    }
+
+    for (int i = 0; i < 16; ++i) {
+        // POP AF replaces the flags of the ADD before it
+        rom.emit({ 0x01, (byte)(i << 4), 0x19 });               // LD BC,19x0
+        rom.emit({ 0xc5, 0x3e, 0xff, 0xc6, 0x01, 0xf1 });       // PUSH BC; LD A,ff; ADD A,1; POP AF
+        sendBranches(rom);
+        rom.emit({ 0x01, (byte)(i << 4), 0x19 });
+        rom.emit({ 0xc5, 0x3e, 0xff, 0xc6, 0x01, 0xf1 });
+        rom.emit(0x27);                                         // DAA
+        sendFlags(rom, true);
+    }
+
+    // The final registers
+    rom.emit({ 0xf5 });                                         // PUSH AF
+    for (byte ld = 0x78; ld <= 0x7d; ++ld)
+        rom.emit(ld).sendA();                                   // LD A,B .. LD A,L
+    sendFlags(rom, true);
+    rom.jr(rom.here());
+    return rom.save("flags");
+}
+
+static const size_t SENT = 2 + VALUE_COUNT * VALUE_COUNT * (7 + 2 * 2) + VALUE_COUNT * 2 * 3 + 16 * (3 + 2) + 6 + 2;
+
+/* Runs the binary built with the other flag mode and returns what it sent */
+static std::string runOther(const char *binary)
+{
+    std::string command = std::string(binary) + " --dump";
+    FILE *fp = popen(command.c_str(), "r");
+    std::string sent;
+    if (!fp)
+        return sent;
+    char buffer[4096];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), fp)) > 0)
+        sent.append(buffer, n);
+    pclose(fp);
+    return sent;
+}
+
+int main(int argc, char *argv[])
+{
+    GameBoy *gb = startRom(flagsRom());
+    std::string sent = runForSerial(gb, SENT);
+    delete gb;
+
+    if (argc == 2 && strcmp(argv[1], "--dump") == 0) {
+        fwrite(sent.data(), 1, sent.size(), stdout);
+        return 0;
+    }
+
+    CHECK_EQUAL(SENT, sent.size());
+    CHECK_EQUAL(0x42, (byte)sent[0]);
+    CHECK_EQUAL(0x00, (byte)sent[1]);
+
+    // Built with GB_LAZY_FLAGS, compare with the core computing F at once
+    if (argc == 2) {
+        std::string eager = runOther(argv[1]);
+        CHECK_EQUAL(SENT, eager.size());
+        for (size_t i = 0; i < sent.size() && i < eager.size(); ++i) {
+            if (sent[i] != eager[i]) {
+                fprintf(stderr, "byte %d\n", (int)i);
+                CHECK_EQUAL((byte)eager[i], (byte)sent[i]);
+                break;
+            }
+        }
+    }
+
+    return testResult("flags");
+}
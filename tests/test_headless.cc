@@ -0,0 +1,90 @@
+#include <stdlib.h>
+#include <sys/wait.h>
+
+#include "testrom.h"
+#include "trace.h"
+
+static const char *headless = 0;
+
+/* Runs gb-headless with nothing on stdin and returns its exit status */
+static int run(const std::string &arguments)
+{
+    std::string command = std::string(headless) + " " + arguments + " < /dev/null > /dev/null 2>&1";
+    int status = system(command.c_str());
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+/* An unknown opcode ends a batch run with an error instead of a prompt */
+static void checkUnknownOpcode()
+{
+    TestRom rom;
+    rom.emit(0x00).emit(0xd3);              // NOP; unused opcode
+    std::string path = rom.save("headless_unknown");
+
+    CHECK_EQUAL(Debugger::EXIT_STOPPED, run("-n 10 " + path));
+
+    // The trace is still complete up to the opcode
+    CHECK_EQUAL(Debugger::EXIT_STOPPED, run("-n 10 -t headless_unknown.trace " + path));
+    TraceReader reader("headless_unknown.trace");
+    CHECK(reader.isOpen());
+    TraceRecord r, last;
+    memset(&last, 0, sizeof(last));
+    while (reader.next(r))
+        if (r.kind == TRACE_INSTRUCTION)
+            last = r;
+    CHECK_EQUAL(0x151, last.pc);
+}
+
+static void checkConditions()
+{
+    TestRom rom;
+    rom.emit({ 0x3e, 'O' }).sendA();
+    rom.emit({ 0x3e, 'K' }).sendA();
+    rom.jr(rom.here());
+    std::string path = rom.save("headless_serial");
+
+    CHECK_EQUAL(0, run("-u serial:OK " + path));
+    CHECK_EQUAL(1, run("-n 5 -u serial:FAIL " + path));
+    CHECK_EQUAL(0, run("-n 5 " + path));
+    CHECK_EQUAL(2, run("-u nonsense " + path));
+}
+
+/* Checking a memory condition leaves no reads in the trace */
+static void checkConditionTrace()
+{
+    TestRom rom;
+    rom.emit({ 0x3e, 0x05, 0xea, 0x00, 0xc0 });    // LD A,5; LD (c000),A
+    rom.jr(rom.here());
+    std::string path = rom.save("headless_memory");
+
+    CHECK_EQUAL(0, run("-n 5 -u c000=05 " + path));
+    CHECK_EQUAL(0, run("-n 5 -u e000=05 " + path));
+    CHECK_EQUAL(1, run("-n 5 -t headless_memory.trace -u c000=07 " + path));
+    TraceReader reader("headless_memory.trace");
+    CHECK(reader.isOpen());
+    TraceRecord r;
+    int writes = 0, reads = 0;
+    while (reader.next(r)) {
+        if (r.kind == TRACE_WRITE && r.address == 0xc000)
+            ++writes;
+        if (r.kind == TRACE_READ && r.address == 0xc000)
+            ++reads;
+    }
+    CHECK_EQUAL(1, writes);
+    CHECK_EQUAL(0, reads);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s gb-headless\n", argv[0]);
+        return 2;
+    }
+    headless = argv[1];
+
+    checkUnknownOpcode();
+    checkConditions();
+    checkConditionTrace();
+
+    return testResult("headless");
+}
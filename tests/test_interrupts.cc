@@ -0,0 +1,117 @@
+#include "testrom.h"
+
+/* Handlers at 0x50, 0x58 and 0x60 count their calls at 0xc000-0xc002 */
+static void countingHandlers(TestRom &rom)
+{
+    for (int i = 0; i < 3; ++i) {
+        rom.at(0x50 + i * 8);
+        rom.emit({ 0x21, (byte)i, 0xc0 });  // LD HL,c000+i
+        rom.emit({ 0x34, 0xd9 });           // INC (HL); RETI
+    }
+}
+
+/*
+ * Enables the timer, serial and joypad interrupts, starts one serial
+ * transfer and spins. Each source has to reach its own handler.
+ */
+static void checkDispatch()
+{
+    TestRom rom;
+    countingHandlers(rom);
+    rom.at(0x150);
+    rom.emit({ 0x3e, 0x1c, 0xe0, 0xff });   // IE = timer, serial, joypad
+    rom.emit({ 0x3e, 0x05, 0xe0, 0x07 });   // TAC: on, 16 cycles per tick
+    rom.emit({ 0x3e, 0x81, 0xe0, 0x02 });   // start a transfer
+    rom.emit(0xfb);                         // EI
+    rom.jr(rom.here());
+
+    GameBoy *gb = startRom(rom.save("interrupts_dispatch"));
+    gb->setButton(BTN_A, true);
+    for (int frames = 0; frames < 10; )
+        frames += gb->process();
+
+    // TIMA overflows every 4096 cycles, about 171 times in ten frames
+    byte timer = gb->peek(0xc000);
+    CHECK(timer >= 165 && timer <= 172);
+    CHECK_EQUAL(1, gb->peek(0xc001));
+    CHECK_EQUAL(1, gb->peek(0xc002));
+    delete gb;
+}
+
+/*
+ * HALTs with only the timer interrupt enabled and sends the handler count
+ * after each wake up. Every overflow has to call the handler exactly once.
+ */
+static void checkHaltTimer()
+{
+    TestRom rom;
+    countingHandlers(rom);
+    rom.at(0x150);
+    rom.emit({ 0x3e, 0x04, 0xe0, 0xff });   // IE = timer
+    rom.emit({ 0x3e, 0x06, 0xe0, 0x07 });   // TAC: on, 64 cycles per tick, longer than a transfer
+    rom.emit(0xfb);                         // EI
+    size_t loop = rom.here();
+    rom.emit(0x76);                         // HALT
+    rom.emit({ 0xfa, 0x00, 0xc0 });         // LD A,(c000)
+    rom.sendA();
+    rom.jr(loop);
+
+    GameBoy *gb = startRom(rom.save("interrupts_halt"));
+    std::string sent = runForSerial(gb, 100);
+    CHECK_EQUAL(100, sent.size());
+    for (size_t i = 0; i < sent.size(); ++i) {
+        if ((byte)sent[i] != i + 1) {
+            CHECK_EQUAL(i + 1, (byte)sent[i]);
+            break;
+        }
+    }
+    delete gb;
+}
+
+/* HALT with interrupts disabled but one pending runs the next byte twice */
+static void checkHaltBug()
+{
+    TestRom rom;
+    rom.emit(0xf3);                         // DI
+    rom.emit({ 0x3e, 0x04, 0xe0, 0xff });   // IE = timer
+    rom.emit({ 0x3e, 0x04, 0xe0, 0x0f });   // IF = timer
+    rom.emit({ 0x06, 0x00 });               // LD B,0
+    rom.emit(0x76);                         // HALT
+    rom.emit(0x04);                         // INC B
+    rom.emit(0x78);                         // LD A,B
+    rom.sendA();
+    rom.jr(rom.here());
+
+    GameBoy *gb = startRom(rom.save("interrupts_haltbug"));
+    std::string sent = runForSerial(gb, 1);
+    CHECK_EQUAL(1, sent.size());
+    if (!sent.empty())
+        CHECK_EQUAL(2, (byte)sent[0]);
+    delete gb;
+}
+
+/* STOP sleeps until a button is pressed, whatever IE says */
+static void checkStop()
+{
+    TestRom rom;
+    rom.emit({ 0x10, 0x00 });               // STOP
+    rom.emit({ 0x3e, 'W' });                // LD A,'W'
+    rom.sendA();
+    rom.jr(rom.here());
+
+    GameBoy *gb = startRom(rom.save("interrupts_stop"));
+    CHECK(runForSerial(gb, 1, 5).empty());
+    gb->setButton(BTN_START, true);
+    CHECK(runForSerial(gb, 1, 5) == "W");
+    delete gb;
+}
+
+int main()
+{
+    checkDispatch();
+    checkHaltTimer();
+    checkHaltBug();
+    checkStop();
+
+    return testResult("interrupts");
+}
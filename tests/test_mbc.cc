@@ -0,0 +1,194 @@
+#include "testrom.h"
+
+/* LD A,value; LD (address),A */
+static void poke(TestRom &rom, word_t address, byte value)
+{
+    rom.emit({ 0x3e, value, 0xea, (byte)address, (byte)(address >> 8) });
+}
+
+/* LD A,(address), then sends it */
+static void report(TestRom &rom, word_t address)
+{
+    rom.emit({ 0xfa, (byte)address, (byte)(address >> 8) }).sendA();
+}
+
+/* Every ROM bank holds its number at 0x3000 and 0x3001 within the bank */
+static void markBanks(TestRom &rom, int banks)
+{
+    for (int bank = 0; bank < banks; ++bank) {
+        rom.at(bank * TestRom::BANK_SIZE + 0x3000);
+        rom.emit((byte)bank).emit((byte)(bank >> 8));
+    }
+}
+
+static void checkSent(const std::string &path, const std::string &expected, bool recompiler = false)
+{
+    GameBoy *gb = startRom(path);
+    if (recompiler && !gb->setRecompiler(true)) {
+        delete gb;
+        return;
+    }
+    std::string sent = runForSerial(gb, expected.size());
+    CHECK_EQUAL(expected.size(), sent.size());
+    for (size_t i = 0; i < sent.size(); ++i) {
+        if (sent[i] != expected[i]) {
+            fprintf(stderr, "%s: byte %d\n", path.c_str(), (int)i);
+            CHECK_EQUAL((byte)expected[i], (byte)sent[i]);
+            break;
+        }
+    }
+    delete gb;
+}
+
+/* MBC1 code has to exist in bank 32 too, mode 1 maps it to 0x0000 */
+static void mbc1Program(TestRom &rom)
+{
+    report(rom, 0x7000);                    // bank 1 after reset
+    poke(rom, 0x2000, 0x00);
+    report(rom, 0x7000);                    // bank 0 selects bank 1
+    poke(rom, 0x2000, 0x05);
+    report(rom, 0x7000);
+    poke(rom, 0x4000, 0x01);
+    report(rom, 0x7000);                    // upper bits apply to 0x4000 in both modes
+    report(rom, 0x3000);                    // and not to 0x0000 in mode 0
+    poke(rom, 0x6000, 0x01);
+    report(rom, 0x3000);                    // mode 1 maps bank 32 to 0x0000
+    poke(rom, 0x6000, 0x00);
+    poke(rom, 0x4000, 0x00);
+
+    report(rom, 0xa000);                    // RAM disabled
+    poke(rom, 0x0000, 0x0a);
+    poke(rom, 0xa000, 0x42);
+    report(rom, 0xa000);
+    poke(rom, 0x6000, 0x01);
+    poke(rom, 0x4000, 0x02);
+    report(rom, 0xa000);                    // RAM bank 2 in mode 1
+    poke(rom, 0xa000, 0x99);
+    poke(rom, 0x4000, 0x00);
+    report(rom, 0xa000);
+    poke(rom, 0x4000, 0x02);
+    report(rom, 0xa000);
+    poke(rom, 0x6000, 0x00);
+    poke(rom, 0x4000, 0x00);
+    poke(rom, 0x0000, 0x00);
+    report(rom, 0xa000);                    // disabled again
+    rom.jr(rom.here());
+}
+
+static void checkMBC1()
+{
+    TestRom rom(0x02, 64, 0x03);
+    markBanks(rom, 64);
+    rom.at(0x150);
+    mbc1Program(rom);
+    rom.at(32 * TestRom::BANK_SIZE + 0x150);
+    mbc1Program(rom);
+
+    checkSent(rom.save("mbc1"), std::string("\x01\x01\x05\x25\x00\x20\xff\x42\x00\x42\x99\xff", 12));
+}
+
+static void checkMBC1WithoutRAM()
+{
+    TestRom rom(0x01, 4);
+    rom.at(0x150);
+    poke(rom, 0x0000, 0x0a);
+    report(rom, 0xa000);
+    poke(rom, 0xa000, 0x12);
+    report(rom, 0xa000);
+    rom.jr(rom.here());
+
+    checkSent(rom.save("mbc1_noram"), "\xff\xff");
+}
+
+/*
+ * Code in bank 1 switches to bank 2, which has other code at the address
+ * after the switch. A block must not run on with ops decoded from bank 1.
+ */
+static void checkSwitchFromBank()
+{
+    TestRom rom(0x01, 4);
+    size_t wait = rom.here();
+    rom.emit({ 0xf0, 0x44, 0xfe, 0x90 });           // LDH A,(44); CP 90
+    rom.emit({ 0x20, (byte)(wait - (rom.here() + 2)) });    // JR NZ,wait, a line to run in
+    rom.emit({ 0xc3, 0x00, 0x40 });                 // JP 4000
+    rom.at(TestRom::BANK_SIZE);
+    poke(rom, 0x2000, 0x02);
+    size_t next = rom.here();
+    rom.emit({ 0x3e, 0x11 }).sendA();               // LD A,11
+    rom.jr(rom.here());
+    rom.at(2 * TestRom::BANK_SIZE + next - TestRom::BANK_SIZE);
+    rom.emit({ 0x3c, 0x3c }).sendA();               // INC A; INC A
+    rom.jr(rom.here());
+
+    std::string path = rom.save("mbc_switch");
+    checkSent(path, "\x04");
+    checkSent(path, "\x04", true);
+}
+
+static void checkMBC3()
+{
+    TestRom rom(0x12, 8, 0x03);
+    markBanks(rom, 8);
+    rom.at(0x150);
+    poke(rom, 0x2000, 0x00);
+    report(rom, 0x7000);                    // bank 0 selects bank 1
+    poke(rom, 0x2000, 0x06);
+    report(rom, 0x7000);
+    poke(rom, 0x2000, 0x87);
+    report(rom, 0x7000);                    // seven bits
+
+    poke(rom, 0x0000, 0x0a);
+    poke(rom, 0x4000, 0x01);
+    poke(rom, 0xa000, 0x11);
+    poke(rom, 0x4000, 0x00);
+    report(rom, 0xa000);
+    poke(rom, 0x4000, 0x01);
+    report(rom, 0xa000);
+    poke(rom, 0x4000, 0x08);
+    report(rom, 0xa000);                    // clock registers are not emulated
+    rom.jr(rom.here());
+
+    checkSent(rom.save("mbc3"), std::string("\x01\x06\x07\x00\x11\xff", 6));
+}
+
+static void checkMBC5()
+{
+    TestRom rom(0x1a, 262, 0x03);
+    markBanks(rom, 262);
+    rom.at(0x150);
+    poke(rom, 0x2000, 0x00);
+    report(rom, 0x7000);                    // bank 0 can be mapped to 0x4000
+    report(rom, 0x7001);
+    poke(rom, 0x2000, 0x05);
+    report(rom, 0x7000);
+    poke(rom, 0x3000, 0x01);
+    report(rom, 0x7000);                    // ninth bit: bank 261
+    report(rom, 0x7001);
+    poke(rom, 0x3000, 0x00);
+    report(rom, 0x7000);
+    report(rom, 0x7001);
+
+    poke(rom, 0x0000, 0x0a);
+    poke(rom, 0x4000, 0x03);
+    poke(rom, 0xa000, 0x33);
+    poke(rom, 0x4000, 0x00);
+    report(rom, 0xa000);
+    poke(rom, 0x4000, 0x03);
+    report(rom, 0xa000);
+    poke(rom, 0x0000, 0x00);
+    report(rom, 0xa000);
+    rom.jr(rom.here());
+
+    checkSent(rom.save("mbc5"), std::string("\x00\x00\x05\x05\x01\x05\x00\x00\x33\xff", 10));
+}
+
+int main()
+{
+    checkMBC1();
+    checkMBC1WithoutRAM();
+    checkSwitchFromBank();
+    checkMBC3();
+    checkMBC5();
+
+    return testResult("mbc");
+}
@@ -0,0 +1,123 @@
+#include "testrom.h"
+#include "trace.h"
+
+/*
+ * Copies INC A; RET to work RAM and calls it, then turns the INC into a DEC
+ * through echo RAM and calls it again. The cached block has to be dropped
+ * by the write to the echo address.
+ */
+static void checkEchoInvalidates()
+{
+    TestRom rom;
+    rom.emit({ 0x21, 0x00, 0xc0 });         // LD HL,c000
+    rom.emit({ 0x36, 0x3c, 0x23 });         // LD (HL),3c; INC HL
+    rom.emit({ 0x36, 0xc9 });               // LD (HL),c9
+    rom.emit({ 0x3e, 0x05 });               // LD A,5
+    rom.emit({ 0xcd, 0x00, 0xc0 }).sendA(); // CALL c000
+    rom.emit({ 0x3e, 0x3d });               // LD A,3d
+    rom.emit({ 0xea, 0x00, 0xe0 });         // LD (e000),A
+    rom.emit({ 0x3e, 0x05 });               // LD A,5
+    rom.emit({ 0xcd, 0x00, 0xc0 }).sendA(); // CALL c000
+    rom.jr(rom.here());
+
+    GameBoy *gb = startRom(rom.save("memory_echo"));
+    CHECK(runForSerial(gb, 2) == std::string("\x06\x04"));
+    CHECK_EQUAL(0x3d, gb->peek(0xc000));
+    delete gb;
+}
+
+/* Writes to the MBC registers show up in traces like any other write */
+static void checkTracedBankSwitch()
+{
+    TestRom rom(0x01, 4);
+    rom.emit({ 0x3e, 0x02, 0xea, 0x00, 0x20 });     // LD A,2; LD (2000),A
+    rom.emit({ 0xfa, 0x00, 0x40 }).sendA();         // LD A,(4000)
+    rom.jr(rom.here());
+
+    GameBoy *gb = startRom(rom.save("memory_mbc_trace"));
+    CHECK(gb->setTrace("memory_mbc.trace"));
+    runForSerial(gb, 1);
+    gb->setTrace(0);
+    delete gb;
+
+    TraceReader reader("memory_mbc.trace");
+    CHECK(reader.isOpen());
+    bool found = false;
+    TraceRecord r;
+    while (reader.next(r))
+        found |= r.kind == TRACE_WRITE && r.address == 0x2000 && r.value == 0x02;
+    CHECK(found);
+}
+
+/* LD A,value; LD (address),A */
+static void poke(TestRom &rom, word_t address, byte value)
+{
+    rom.emit({ 0x3e, value, 0xea, (byte)address, (byte)(address >> 8) });
+}
+
+/* LD A,(address), then sends it */
+static void report(TestRom &rom, word_t address)
+{
+    rom.emit({ 0xfa, (byte)address, (byte)(address >> 8) }).sendA();
+}
+
+/* Waits for LY to reach the line */
+static void waitLine(TestRom &rom, byte line)
+{
+    size_t wait = rom.here();
+    rom.emit({ 0xf0, 0x44, 0xfe, line });                   // LDH A,(44); CP line
+    rom.emit({ 0x20, (byte)(wait - (rom.here() + 2)) });    // JR NZ,wait
+}
+
+/*
+ * Sends what battery RAM holds, then writes two pages of it, lets a frame
+ * flush them, and writes the first page again and a third one. Pages
+ * written after a flush have to be saved as well.
+ */
+static void checkSaveRam()
+{
+    TestRom rom(0x03, 2, 0x03);
+    poke(rom, 0x0000, 0x0a);
+    report(rom, 0xa000);
+    report(rom, 0xa100);
+    report(rom, 0xb000);
+    poke(rom, 0xa000, 0x11);
+    poke(rom, 0xa100, 0x22);
+    waitLine(rom, 0x90);
+    waitLine(rom, 0x91);
+    poke(rom, 0xa000, 0x44);
+    poke(rom, 0xb000, 0x33);
+    rom.emit({ 0x3e, 0x01 }).sendA();
+    rom.jr(rom.here());
+    std::string path = rom.save("memory_save");
+    remove("memory_save.sav");
+
+    GameBoy *gb = startRom(path);
+    CHECK(runForSerial(gb, 4) == std::string("\x00\x00\x00\x01", 4));
+    delete gb;
+
+    byte saved[0x2000];
+    FILE *fp = fopen("memory_save.sav", "rb");
+    CHECK(fp != 0);
+    if (fp) {
+        CHECK_EQUAL(sizeof(saved), fread(saved, 1, sizeof(saved), fp));
+        fclose(fp);
+        CHECK_EQUAL(0x44, saved[0x0000]);
+        CHECK_EQUAL(0x22, saved[0x0100]);
+        CHECK_EQUAL(0x33, saved[0x1000]);
+    }
+
+    // Reopened, the ROM reads back what it wrote
+    gb = startRom(path);
+    CHECK(runForSerial(gb, 4) == "\x44\x22\x33\x01");
+    delete gb;
+}
+
+int main()
+{
+    checkEchoInvalidates();
+    checkTracedBankSwitch();
+    checkSaveRam();
+
+    return testResult("memory");
+}
@@ -0,0 +1,230 @@
+#include <string.h>
+
+#include "testrom.h"
+
+static const byte SCX = 3;
+static const byte SCY = 5;
+static const byte WX = 87;
+static const byte WY = 100;
+static const byte SCX2 = 6;
+static const byte SCROLL_LINE = 120;    /* SCX is SCX2 from this line on */
+static const byte PALETTE_LINE = 130;   /* BGP is inverted from this line on */
+static const byte TALL_LINE = 110;      /* sprites are 8x16 from this line on */
+
+/* Where the scene data is kept in the ROM */
+static const word_t TILES = 0x1000;
+static const word_t BG_MAP = 0x1100;
+static const word_t WINDOW_MAP = 0x1500;
+static const word_t SPRITES = 0x1900;
+
+/* LD HL,source; LD DE,destination; LD BC,length; then copies byte by byte */
+static void copy(TestRom &rom, word_t source, word_t destination, word_t length)
+{
+    rom.emit({ 0x21, (byte)source, (byte)(source >> 8) });
+    rom.emit({ 0x11, (byte)destination, (byte)(destination >> 8) });
+    rom.emit({ 0x01, (byte)length, (byte)(length >> 8) });
+    size_t loop = rom.here();
+    rom.emit({ 0x2a, 0x12, 0x13, 0x0b });       // LD A,(HL+); LD (DE),A; INC DE; DEC BC
+    rom.emit({ 0x78, 0xb1 });                   // LD A,B; OR C
+    rom.emit({ 0x20, (byte)(loop - (rom.here() + 2)) });    // JR NZ,loop
+}
+
+/* LD A,value; LDH (register),A */
+static void setRegister(TestRom &rom, byte reg, byte value)
+{
+    rom.emit({ 0x3e, value, 0xe0, reg });
+}
+
+static void waitLine(TestRom &rom, byte line)
+{
+    size_t wait = rom.here();
+    rom.emit({ 0xf0, 0x44, 0xfe, line });                   // LDH A,(44); CP line
+    rom.emit({ 0x20, (byte)(wait - (rom.here() + 2)) });    // JR NZ,wait
+}
+
+/* Puts a sprite covering the screen position x, y */
+static void sprite(TestRom &rom, int index, int x, int y, byte tile, byte attr)
+{
+    rom.at(SPRITES + index * 4);
+    rom.emit((byte)(y + 16)).emit((byte)(x + 8)).emit(tile).emit(attr);
+}
+
+/*
+ * Tiles: 0 blank, 1 to 3 solid in that color, 4 with color 3 in its top
+ * left and color 1 in its bottom right corner, 6 and 7 solid 2 and 3 as
+ * the halves of a tall sprite. The background is a checkerboard of tiles 0
+ * and 1, the window is all tile 3. SCX, BGP and the sprite size change
+ * between lines, every frame.
+ */
+static std::string sceneRom()
+{
+    TestRom rom;
+    for (int row = 0; row < 8; ++row) {
+        for (int tile = 1; tile <= 3; ++tile) {
+            rom.at(TILES + tile * 16 + row * 2);
+            rom.emit(tile & 1 ? 0xff : 0x00).emit(tile & 2 ? 0xff : 0x00);
+        }
+        rom.at(TILES + 6 * 16 + row * 2).emit({ 0x00, 0xff });
+        rom.at(TILES + 7 * 16 + row * 2).emit({ 0xff, 0xff });
+    }
+    rom.at(TILES + 4 * 16).emit({ 0x80, 0x80 });
+    rom.at(TILES + 4 * 16 + 14).emit({ 0x01, 0x00 });
+
+    for (int y = 0; y < 32; ++y) {
+        for (int x = 0; x < 32; ++x) {
+            rom.at(BG_MAP + y * 32 + x).emit((x + y) & 1);
+            rom.at(WINDOW_MAP + y * 32 + x).emit(3);
+        }
+    }
+
+    // Eleven sprites on one line, the last is over the limit
+    for (int i = 0; i < 11; ++i)
+        sprite(rom, i, i * 12, 20, 3, 0x00);
+
+    // The smaller X wins an overlap, then the lower OAM index
+    sprite(rom, 11, 50, 40, 1, 0x00);
+    sprite(rom, 12, 46, 40, 2, 0x00);
+    sprite(rom, 13, 100, 40, 1, 0x00);
+    sprite(rom, 14, 100, 40, 3, 0x00);
+
+    // No flip, X, Y, both
+    for (int i = 0; i < 4; ++i)
+        sprite(rom, 15 + i, 10 + i * 20, 60, 4, i << 5);
+
+    // Behind the background, and in OBP1
+    sprite(rom, 19, 20, 80, 3, 0x80);
+    sprite(rom, 20, 60, 80, 1, 0x10);
+
+    // Tall over the window, the tile number's low bit is ignored; then flipped
+    sprite(rom, 21, 100, 112, 7, 0x00);
+    sprite(rom, 22, 120, 112, 7, 0x40);
+
+    rom.at(0x150);
+    setRegister(rom, 0x40, 0x00);               // LCD off
+    copy(rom, TILES, 0x8000, 8 * 16);
+    copy(rom, BG_MAP, 0x9800, 0x400);
+    copy(rom, WINDOW_MAP, 0x9c00, 0x400);
+    copy(rom, SPRITES, 0xfe00, 0xa0);
+    setRegister(rom, 0x42, SCY);
+    setRegister(rom, 0x43, SCX);
+    setRegister(rom, 0x4a, WY);
+    setRegister(rom, 0x4b, WX);
+    setRegister(rom, 0x47, 0xe4);
+    setRegister(rom, 0x48, 0xe4);
+    setRegister(rom, 0x49, 0x1b);
+    setRegister(rom, 0x40, 0xf3);               // on: window at 9c00, tiles at 8000, sprites, BG
+    rom.emit({ 0x3e, 0x01 }).sendA();
+
+    size_t loop = rom.here();
+    waitLine(rom, 0);
+    setRegister(rom, 0x43, SCX);
+    setRegister(rom, 0x47, 0xe4);
+    setRegister(rom, 0x40, 0xf3);
+    waitLine(rom, TALL_LINE);
+    setRegister(rom, 0x40, 0xf7);
+    waitLine(rom, SCROLL_LINE);
+    setRegister(rom, 0x43, SCX2);
+    waitLine(rom, PALETTE_LINE);
+    setRegister(rom, 0x47, 0x1b);
+    rom.jr(loop);
+    return rom.save("ppu_scene");
+}
+
+/* Color index of the scrolled checkerboard */
+static byte background(int x, int y)
+{
+    int scx = y < SCROLL_LINE ? SCX : SCX2;
+    return (((x + scx) >> 3) + ((y + SCY) >> 3)) & 1;
+}
+
+static byte pixel(const byte *screen, int x, int y)
+{
+    return screen[y * GB_DISPLAY_WIDTH + x];
+}
+
+int main()
+{
+    GameBoy *gb = startRom(sceneRom());
+    CHECK(runForSerial(gb, 1) == "\x01");
+    for (int frames = 0; frames < 3; )
+        if (gb->process())
+            ++frames;
+    const byte *screen = gb->getScreen();
+
+    // Scrolled background, and the window from WX-7, WY
+    for (int x = 0; x < GB_DISPLAY_WIDTH; ++x)
+        CHECK_EQUAL(background(x, 10), pixel(screen, x, 10));
+    CHECK_EQUAL(background(79, 105), pixel(screen, 79, 105));
+    CHECK_EQUAL(3, pixel(screen, 80, 105));
+    CHECK_EQUAL(background(90, 99), pixel(screen, 90, 99));
+    CHECK_EQUAL(3, pixel(screen, 90, 100));
+
+    // Scrolled differently below the line where SCX changed
+    for (int x = 0; x < WX - 7; ++x)
+        CHECK_EQUAL(background(x, SCROLL_LINE), pixel(screen, x, SCROLL_LINE));
+    CHECK_EQUAL(3, pixel(screen, 80, SCROLL_LINE));
+
+    // Ten sprites per line
+    CHECK_EQUAL(3, pixel(screen, 108, 22));
+    CHECK_EQUAL(background(120, 22), pixel(screen, 120, 22));
+
+    // X priority
+    CHECK_EQUAL(2, pixel(screen, 48, 42));
+    CHECK_EQUAL(2, pixel(screen, 51, 42));
+    CHECK_EQUAL(1, pixel(screen, 55, 42));
+    CHECK_EQUAL(1, pixel(screen, 102, 42));
+
+    // Flips move the two corners
+    CHECK_EQUAL(3, pixel(screen, 10, 60));
+    CHECK_EQUAL(1, pixel(screen, 17, 67));
+    CHECK_EQUAL(3, pixel(screen, 37, 60));
+    CHECK_EQUAL(1, pixel(screen, 30, 67));
+    CHECK_EQUAL(3, pixel(screen, 50, 67));
+    CHECK_EQUAL(1, pixel(screen, 57, 60));
+    CHECK_EQUAL(3, pixel(screen, 77, 67));
+    CHECK_EQUAL(1, pixel(screen, 70, 60));
+    CHECK_EQUAL(background(11, 60), pixel(screen, 11, 60));
+
+    // Behind the background only color 0 lets the sprite through
+    for (int x = 20; x < 28; ++x)
+        CHECK_EQUAL(background(x, 82) ? 1 : 3, pixel(screen, x, 82));
+    CHECK_EQUAL(2, pixel(screen, 62, 82));
+
+    // Tall sprites, and flipped as a whole
+    CHECK_EQUAL(2, pixel(screen, 102, 113));
+    CHECK_EQUAL(3, pixel(screen, 102, 121));
+    CHECK_EQUAL(3, pixel(screen, 122, 113));
+    CHECK_EQUAL(2, pixel(screen, 122, 121));
+
+    // Frames hold shades, after the palette of their line
+    for (int x = 0; x < WX - 7; ++x)
+        CHECK_EQUAL(3 - background(x, PALETTE_LINE), pixel(screen, x, PALETTE_LINE));
+    CHECK_EQUAL(0, pixel(screen, 80, PALETTE_LINE));
+
+    // Front ends get the same colors in either format, one per shade
+    static byte rgb[GB_DISPLAY_WIDTH * GB_DISPLAY_HEIGHT * 3];
+    static uint32_t rgba[GB_DISPLAY_WIDTH * GB_DISPLAY_HEIGHT];
+    shadesToRGB(screen, rgb, GB_DISPLAY_WIDTH * GB_DISPLAY_HEIGHT);
+    shadesToRGBA(screen, rgba, GB_DISPLAY_WIDTH * GB_DISPLAY_HEIGHT);
+    int mismatches = 0;
+    for (int i = 0; i < GB_DISPLAY_WIDTH * GB_DISPLAY_HEIGHT; ++i) {
+        const byte *c = (const byte *)&rgba[i];
+        if (memcmp(c, rgb + i * 3, 3) != 0 || c[3] != 0xff)
+            ++mismatches;
+    }
+    CHECK_EQUAL(0, mismatches);
+    const byte shades[4] = { 0, 1, 2, 3 };
+    byte colors[4 * 3];
+    shadesToRGB(shades, colors, 4);
+    for (int i = 1; i < 4; ++i)
+        CHECK(memcmp(colors + (i - 1) * 3, colors + i * 3, 3) != 0);
+
+    // Everything else about the frame stays as it is
+    uint64_t hash = 1469598103934665603ULL;
+    for (int i = 0; i < GB_DISPLAY_WIDTH * GB_DISPLAY_HEIGHT; ++i)
+        hash = (hash ^ screen[i]) * 1099511628211ULL;
+    CHECK_EQUAL(0x90d34a1a52fc8cd7ULL, hash);
+    delete gb;
+
+    return testResult("ppu");
+}
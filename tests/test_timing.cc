@@ -0,0 +1,191 @@
+#include "testrom.h"
+
+static const int SAMPLES = 200;
+
+/*
+ * Reads DIV after 40 NOPs and sends it, in a loop of 216 cycles. The read
+ * sees the cycles of every instruction before it, so any execution path
+ * which accounts cycles per block instead of per instruction sends
+ * different values.
+ */
+static std::string divRom()
+{
+    TestRom rom;
+    size_t loop = rom.here();
+    for (int i = 0; i < 40; ++i)
+        rom.emit(0x00);                 // NOP
+    rom.emit({ 0xf0, 0x04 });           // LDH A,(04)
+    rom.sendA();
+    rom.jr(loop);
+    return rom.save("timing_div");
+}
+
+/* The entry point takes 20 cycles, the loop reads DIV 160 cycles in */
+static byte expectedDiv(int iteration)
+{
+    return (20 + 160 + 216 * iteration) >> 8;
+}
+
+static void checkDiv(GameBoy *gb)
+{
+    std::string sent = runForSerial(gb, SAMPLES);
+    CHECK_EQUAL(SAMPLES, sent.size());
+    for (size_t i = 0; i < sent.size(); ++i) {
+        if ((byte)sent[i] != expectedDiv(i)) {
+            CHECK_EQUAL(expectedDiv(i), (byte)sent[i]);
+            break;
+        }
+    }
+}
+
+/*
+ * Reads LY after 50 NOPs in a loop. LY changes in events, so a block which
+ * runs past the next event reads the line before it.
+ */
+static std::string lyRom()
+{
+    TestRom rom;
+    size_t loop = rom.here();
+    for (int i = 0; i < 50; ++i)
+        rom.emit(0x00);                 // NOP
+    rom.emit({ 0xf0, 0x44 });           // LDH A,(44)
+    rom.sendA();
+    rom.jr(loop);
+    return rom.save("timing_ly");
+}
+
+/*
+ * Enables the timer interrupt and raises it in the middle of a block. The
+ * handler has to run right after the write to IF, before the block sends
+ * its own byte.
+ */
+static std::string interruptRom()
+{
+    TestRom rom;
+    rom.at(0x50).emit({ 0x3e, 0xaa }).sendA().emit(0xd9);  // LD A,aa; send; RETI
+    rom.at(0x150);
+    size_t wait = rom.here();
+    rom.emit({ 0xf0, 0x44, 0xfe, 0x90 });   // LDH A,(44); CP 90
+    rom.emit({ 0x20, (byte)(wait - (rom.here() + 2)) });      // JR NZ,wait, a line to run in
+    rom.emit({ 0xfb, 0x00 });               // EI; NOP
+    rom.emit({ 0x3e, 0x04, 0xe0, 0xff });   // IE = timer
+    rom.emit({ 0xe0, 0x0f });               // IF = timer
+    rom.emit({ 0x3e, 0x55 }).sendA();
+    rom.jr(rom.here());
+    return rom.save("timing_interrupt");
+}
+
+/*
+ * Mixes instructions the recompiler translates with ones it calls, and
+ * sends every register and LY on each iteration.
+ */
+static std::string registerRom()
+{
+    TestRom rom;
+    rom.emit({ 0x01, 0x02, 0x01 });         // LD BC,0102
+    rom.emit({ 0x11, 0x04, 0x03 });         // LD DE,0304
+    rom.emit({ 0x26, 0x05, 0x2e, 0x06 });   // LD H,5; LD L,6
+    size_t loop = rom.here();
+    rom.emit({ 0x03, 0x79, 0x80, 0x67 });   // INC BC; LD A,C; ADD A,B; LD H,A
+    rom.emit({ 0x1b, 0x7b, 0xa9, 0x6f });   // DEC DE; LD A,E; XOR C; LD L,A
+    rom.emit(0x23);                         // INC HL
+    for (int i = 0; i < 10; ++i)
+        rom.emit(0x00);                     // NOP
+    rom.emit(0xf5);                         // PUSH AF
+    for (byte ld = 0x78; ld <= 0x7d; ++ld)
+        rom.emit(ld).sendA();               // LD A,B .. LD A,L
+    rom.emit({ 0xd1, 0x7a }).sendA();       // POP DE; LD A,D
+    rom.emit(0x7b).sendA();                 // LD A,E
+    rom.emit({ 0xf0, 0x44 }).sendA();       // LDH A,(44)
+    rom.jr(loop);
+    return rom.save("timing_registers");
+}
+
+/* Runs a ROM on the plain interpreter or on blocks, which may be native */
+static std::string run(const std::string &path, size_t count, bool blocks, bool recompiler, int frames = 60)
+{
+    GameBoy *gb = startRom(path);
+    gb->setBlockCache(blocks);
+    if (recompiler)
+        gb->setRecompiler(true);
+    std::string sent = runForSerial(gb, count, frames);
+    delete gb;
+    return sent;
+}
+
+/*
+ * Waits in idle loops for a flag set by the timer handler, for LY and for
+ * the STAT mode, and sends DIV after each. Fast-forwarding these loops must
+ * end them at the same cycle as running them.
+ */
+static std::string idleRom()
+{
+    TestRom rom;
+    rom.at(0x50).emit({ 0x3e, 0x01, 0xe0, 0x80, 0xd9 });   // LD A,1; LDH (80),A; RETI
+    rom.at(0x150);
+    rom.emit({ 0x3e, 0x04, 0xe0, 0xff });   // IE = timer
+    rom.emit({ 0x3e, 0x05, 0xe0, 0x07 });   // TAC: on, 16 cycles per tick
+    rom.emit(0xfb);                         // EI
+    size_t loop = rom.here();
+
+    size_t wait = rom.here();
+    rom.emit({ 0xf0, 0x80, 0xa7 });         // LDH A,(80); AND A
+    rom.emit({ 0x28, (byte)(wait - (rom.here() + 2)) });      // JR Z,wait
+    rom.emit({ 0xaf, 0xe0, 0x80 });         // XOR A; LDH (80),A
+    rom.emit({ 0xf0, 0x04 }).sendA();
+
+    wait = rom.here();
+    rom.emit({ 0xf0, 0x44, 0xfe, 0x90 });   // LDH A,(44); CP 90
+    rom.emit({ 0x20, (byte)(wait - (rom.here() + 2)) });      // JR NZ,wait
+    rom.emit({ 0xf0, 0x04 }).sendA();
+
+    wait = rom.here();
+    rom.emit({ 0xf0, 0x41, 0xe6, 0x03 });   // LDH A,(41); AND 3
+    rom.emit({ 0x20, (byte)(wait - (rom.here() + 2)) });      // JR NZ,wait
+    rom.emit({ 0xf0, 0x04 }).sendA();
+
+    rom.jr(loop);
+    return rom.save("timing_idle");
+}
+
+int main()
+{
+    std::string path = divRom();
+
+    GameBoy *gb = startRom(path);
+    checkDiv(gb);
+    delete gb;
+
+    // Native blocks must see the same cycle counts
+    gb = startRom(path);
+    if (gb->setRecompiler(true))
+        checkDiv(gb);
+    delete gb;
+
+    // Blocks end before the next event and after writes to IE and IF
+    path = lyRom();
+    std::string reference = run(path, SAMPLES, false, false);
+    CHECK_EQUAL(SAMPLES, reference.size());
+    CHECK(run(path, SAMPLES, true, false) == reference);
+    CHECK(run(path, SAMPLES, true, true) == reference);
+
+    path = interruptRom();
+    CHECK(run(path, 2, false, false) == "\xaa\x55");
+    CHECK(run(path, 2, true, false) == "\xaa\x55");
+    CHECK(run(path, 2, true, true) == "\xaa\x55");
+
+    path = registerRom();
+    reference = run(path, 9 * SAMPLES, false, false);
+    CHECK_EQUAL(9 * SAMPLES, reference.size());
+    CHECK(run(path, 9 * SAMPLES, true, false) == reference);
+    CHECK(run(path, 9 * SAMPLES, true, true) == reference);
+
+    path = idleRom();
+    // Idle loops are only skipped in blocks, the interpreter runs every iteration
+    reference = run(path, 300, false, false, 600);
+    CHECK_EQUAL(300, reference.size());
+    CHECK(run(path, 300, true, false, 600) == reference);
+    CHECK(run(path, 300, true, true, 600) == reference);
+
+    return testResult("timing");
+}
@@ -0,0 +1,109 @@
+#ifndef TESTROM_H
+#define TESTROM_H
+
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include "gameboy.h"
+#include "debugger.h"
+
+/*
+ * Builds a small ROM image byte by byte. Test programs report results by
+ * sending bytes over the link port, which GameBoy::getSerialOutput() keeps.
+ */
+class TestRom
+{
+private:
+    std::vector<byte> data;
+    size_t offset;
+
+public:
+    static const size_t BANK_SIZE = 0x4000;
+
+    TestRom(byte type = 0x00, int banks = 2, byte ramSize = 0x00)
+        : data(banks * BANK_SIZE, 0x00), offset(0x150) {
+        data[0x147] = type;
+        data[0x149] = ramSize;
+        // Entry point: NOP, JP 0x0150
+        at(0x100).emit(0x00).emit(0xc3).emit(0x50).emit(0x01);
+        at(0x150);
+    };
+
+    /* Continues at a file offset, offsets past 0x4000 are in switchable banks */
+    TestRom &at(size_t position) { offset = position; return *this; };
+    size_t here() const { return offset; };
+
+    TestRom &emit(byte b) { data[offset++] = b; return *this; };
+    TestRom &emit(const std::vector<byte> &bytes) {
+        for (size_t i = 0; i < bytes.size(); ++i)
+            emit(bytes[i]);
+        return *this;
+    };
+
+    /* LDH (01),A; LD A,81; LDH (02),A */
+    TestRom &sendA() { return emit({ 0xe0, 0x01, 0x3e, 0x81, 0xe0, 0x02 }); };
+
+    /* JR to an address emitted before */
+    TestRom &jr(size_t target) { return emit(0x18).emit((byte)(target - (offset + 1))); };
+
+    /* Writes the image to the working directory and returns its path */
+    std::string save(const char *name) const {
+        std::string path = std::string(name) + ".gb";
+        FILE *fp = fopen(path.c_str(), "wb");
+        if (fp) {
+            fwrite(&data[0], 1, data.size(), fp);
+            fclose(fp);
+        }
+        return path;
+    };
+};
+
+/* Runs a ROM without the debugger stepping in, or waiting for input */
+inline GameBoy *startRom(const std::string &path)
+{
+    GameBoy *gb = new GameBoy(path.c_str());
+    gb->getDebugger()->stepMode = false;
+    gb->getDebugger()->interactive = false;
+    return gb;
+}
+
+/* Runs until the ROM sent count bytes, or gives up after the given frames */
+inline std::string runForSerial(GameBoy *gb, size_t count, int frames = 60)
+{
+    while (gb->getSerialOutput().size() < count && frames > 0)
+        if (gb->process())
+            --frames;
+    return gb->getSerialOutput().substr(0, count);
+}
+
+static int testFailures = 0;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            ++testFailures; \
+        } \
+    } while (0)
+
+#define CHECK_EQUAL(expected, actual) \
+    do { \
+        long long e = (expected), a = (actual); \
+        if (e != a) { \
+            fprintf(stderr, "%s:%d: %s is %lld, expected %lld\n", __FILE__, __LINE__, #actual, a, e); \
+            ++testFailures; \
+        } \
+    } while (0)
+
+inline int testResult(const char *name)
+{
+    if (testFailures)
+        fprintf(stderr, "%s: %d check(s) failed\n", name, testFailures);
+    else
+        printf("%s: passed\n", name);
+    return testFailures ? 1 : 0;
+}
+
+#endif
@@ -0,0 +1,7 @@
+#include "tilecache.h"
+
+TileCache::TileCache(const byte *vram) : vram(vram), decoder(bestTileDecoder())
+{
+    for (int tile = 0; tile < TILE_COUNT; ++tile)
+        dirty[tile] = true;
+}
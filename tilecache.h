@@ -0,0 +1,44 @@
+#ifndef TILECACHE_H
+#define TILECACHE_H
+
+#include "tiledecoder.h"
+#include "word.h"
+
+/*
+ * The 384 tiles of 0x8000-0x97ff expanded to one color index per pixel,
+ * with a mirrored copy for horizontally flipped sprites. Writes to tile
+ * data only mark the tile; it is decoded again when it is next drawn.
+ */
+class TileCache
+{
+private:
+    static const int TILE_COUNT = 384;
+
+    const byte *vram;
+    TileDecoder decoder;
+    byte pixels[TILE_COUNT][8][8];
+    byte flipped[TILE_COUNT][8][8];
+    bool dirty[TILE_COUNT];
+
+    inline void decode(int tile) {
+        decoder(vram + tile * 16, pixels[tile][0], flipped[tile][0]);
+        dirty[tile] = false;
+    };
+
+public:
+    TileCache(const byte *vram);
+
+    /* Called by Memory for writes to tile data */
+    inline void invalidate(word address) {
+        dirty[(address.value() - 0x8000) >> 4] = true;
+    };
+
+    /* Eight color indices of a row of a tile, tiles are numbered from 0x8000 */
+    inline const byte *row(int tile, int y, bool flip) {
+        if (dirty[tile])
+            decode(tile);
+        return flip ? flipped[tile][y] : pixels[tile][y];
+    };
+};
+
+#endif
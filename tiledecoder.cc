@@ -0,0 +1,84 @@
+#include <string.h>
+
+#include "tiledecoder.h"
+
+#ifdef TILE_DECODER_X86
+#include <immintrin.h>
+#endif
+
+void decodeTileScalar(const byte *data, byte *pixels, byte *flipped)
+{
+    for (int y = 0; y < 8; ++y) {
+        byte lo = data[y * 2];
+        byte hi = data[y * 2 + 1];
+        for (int x = 0; x < 8; ++x) {
+            int bit = 7 - x;
+            byte index = ((lo >> bit) & 1) | (((hi >> bit) & 1) << 1);
+            pixels[y * 8 + x] = index;
+            flipped[y * 8 + 7 - x] = index;
+        }
+    }
+}
+
+#ifdef TILE_DECODER_X86
+
+/*
+ * Two rows per register: each bitplane byte is broadcast to eight lanes and
+ * tested against one bit per lane, leftmost pixel in the lowest lane.
+ */
+__attribute__((target("sse2")))
+void decodeTileSSE2(const byte *data, byte *pixels, byte *flipped)
+{
+    const __m128i bits = _mm_set1_epi64x(0x0102040810204080ULL);
+    const __m128i mirrored = _mm_set1_epi64x(0x8040201008040201ULL);
+    const __m128i one = _mm_set1_epi8(1);
+    const __m128i two = _mm_set1_epi8(2);
+    const uint64_t spread = 0x0101010101010101ULL;
+
+    for (int y = 0; y < 8; y += 2) {
+        __m128i lo = _mm_set_epi64x(data[y * 2 + 2] * spread, data[y * 2] * spread);
+        __m128i hi = _mm_set_epi64x(data[y * 2 + 3] * spread, data[y * 2 + 1] * spread);
+
+        __m128i p = _mm_or_si128(
+            _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(lo, bits), bits), one),
+            _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(hi, bits), bits), two));
+        __m128i f = _mm_or_si128(
+            _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(lo, mirrored), mirrored), one),
+            _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(hi, mirrored), mirrored), two));
+
+        _mm_storeu_si128((__m128i *)(pixels + y * 8), p);
+        _mm_storeu_si128((__m128i *)(flipped + y * 8), f);
+    }
+}
+
+/*
+ * PDEP moves bit n of a bitplane into byte n, which is the mirrored row;
+ * swapping the bytes gives the row as displayed.
+ */
+__attribute__((target("bmi2")))
+void decodeTileBMI2(const byte *data, byte *pixels, byte *flipped)
+{
+    for (int y = 0; y < 8; ++y) {
+        uint64_t f = _pdep_u64(data[y * 2], 0x0101010101010101ULL)
+                   | _pdep_u64(data[y * 2 + 1], 0x0202020202020202ULL);
+        uint64_t p = __builtin_bswap64(f);
+        memcpy(flipped + y * 8, &f, 8);
+        memcpy(pixels + y * 8, &p, 8);
+    }
+}
+
+#endif
+
+TileDecoder bestTileDecoder()
+{
+#ifdef TILE_DECODER_X86
+    __builtin_cpu_init();
+    // PDEP is microcoded, and slower than SSE2, on AMD before Zen 3
+    if (__builtin_cpu_supports("bmi2") && !__builtin_cpu_is("bdver4") &&
+        !__builtin_cpu_is("znver1") && !__builtin_cpu_is("znver2"))
+        return decodeTileBMI2;
+    if (__builtin_cpu_supports("sse2"))
+        return decodeTileSSE2;
+#endif
+    return decodeTileScalar;
+}
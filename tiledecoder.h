@@ -0,0 +1,25 @@
+#ifndef TILEDECODER_H
+#define TILEDECODER_H
+
+#include "word.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define TILE_DECODER_X86
+#endif
+
+/*
+ * Expands the 16 bytes of a tile into 64 color indices, row by row, and
+ * into the same rows mirrored for flipped sprites.
+ */
+typedef void (*TileDecoder)(const byte *data, byte *pixels, byte *flipped);
+
+void decodeTileScalar(const byte *data, byte *pixels, byte *flipped);
+#ifdef TILE_DECODER_X86
+void decodeTileSSE2(const byte *data, byte *pixels, byte *flipped);
+void decodeTileBMI2(const byte *data, byte *pixels, byte *flipped);
+#endif
+
+/* The fastest decoder the CPU supports */
+TileDecoder bestTileDecoder();
+
+#endif
@@ -0,0 +1,84 @@
+#include <string.h>
+
+#include <chrono>
+#include <iostream>
+
+#include "trace.h"
+
+static const char TRACE_MAGIC[8] = { 'G', 'B', 'T', 'R', 'A', 'C', 'E', (char)sizeof(TraceRecord) };
+
+TraceWriter::TraceWriter(const char *path) : file(0), ring(0), head(0), tail(0), running(true)
+{
+    // Favour speed, traces of long runs are large anyway
+    file = gzopen(path, "wb1");
+    if (!file) {
+        std::cerr << "Cannot open trace file: " << path << std::endl;
+        return;
+    }
+    gzwrite(file, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+
+    ring = new TraceRecord[RING_SIZE];
+    writer = std::thread(&TraceWriter::drain, this);
+}
+
+TraceWriter::~TraceWriter()
+{
+    if (!file)
+        return;
+    running.store(false, std::memory_order_release);
+    writer.join();
+    gzclose(file);
+    delete [] ring;
+}
+
+void TraceWriter::drain()
+{
+    while (true) {
+        // Read the flag first, so records made before it was cleared are written
+        bool stopping = !running.load(std::memory_order_acquire);
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t h = head.load(std::memory_order_acquire);
+
+        if (t == h) {
+            if (stopping)
+                return;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+
+        // Write up to the end of the ring, the rest follows in the next round
+        size_t start = t & (RING_SIZE - 1);
+        size_t count = h - t;
+        if (start + count > RING_SIZE)
+            count = RING_SIZE - start;
+        gzwrite(file, ring + start, count * sizeof(TraceRecord));
+        tail.store(t + count, std::memory_order_release);
+    }
+}
+
+TraceReader::TraceReader(const char *path) : file(0)
+{
+    file = gzopen(path, "rb");
+    if (!file) {
+        std::cerr << "Cannot open trace file: " << path << std::endl;
+        return;
+    }
+
+    char magic[sizeof(TRACE_MAGIC)];
+    if (gzread(file, magic, sizeof(magic)) != sizeof(magic) || memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0) {
+        std::cerr << "Not a trace file: " << path << std::endl;
+        gzclose(file);
+        file = 0;
+    }
+}
+
+TraceReader::~TraceReader()
+{
+    if (file)
+        gzclose(file);
+}
+
+bool TraceReader::next(TraceRecord &r)
+{
+    return file && gzread(file, &r, sizeof(r)) == sizeof(r);
+}
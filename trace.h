@@ -0,0 +1,82 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <thread>
+
+#include <zlib.h>
+
+#include "word.h"
+
+enum TraceKind
+{
+    TRACE_INSTRUCTION = 0,
+    TRACE_READ        = 1,
+    TRACE_WRITE       = 2,
+    TRACE_INTERRUPT   = 3
+};
+
+/*
+ * One fixed-size trace entry. Instructions carry the registers before they
+ * execute and their opcode in value; memory accesses and interrupts carry
+ * the pc of the instruction causing them, address and value, and leave the
+ * other registers zero.
+ */
+struct TraceRecord
+{
+    uint64_t cycles;
+    word_t pc, af, bc, de, hl, sp;
+    word_t address;
+    byte kind;
+    byte value;
+};
+
+/*
+ * Writes records to a gzip file. The emulator thread only copies a record
+ * into a single-producer single-consumer ring; a background thread drains
+ * the ring and compresses it. A full ring makes the emulator wait rather
+ * than drop records, so a trace is always complete.
+ */
+class TraceWriter
+{
+private:
+    static const size_t RING_SIZE = 1 << 16;    /* records, a power of two */
+
+    gzFile file;
+    TraceRecord *ring;
+    std::atomic<size_t> head;   /* next record to fill, owned by the emulator */
+    std::atomic<size_t> tail;   /* next record to write, owned by the writer */
+    std::atomic<bool> running;
+    std::thread writer;
+
+    void drain();
+
+public:
+    TraceWriter(const char *path);
+    ~TraceWriter();
+
+    bool isOpen() const { return file != 0; };
+
+    inline void record(const TraceRecord &r) {
+        size_t h = head.load(std::memory_order_relaxed);
+        while (h - tail.load(std::memory_order_acquire) == RING_SIZE)
+            std::this_thread::yield();
+        ring[h & (RING_SIZE - 1)] = r;
+        head.store(h + 1, std::memory_order_release);
+    };
+};
+
+class TraceReader
+{
+private:
+    gzFile file;
+
+public:
+    TraceReader(const char *path);
+    ~TraceReader();
+
+    bool isOpen() const { return file != 0; };
+    bool next(TraceRecord &r);
+};
+
+#endif
@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <deque>
+#include <string>
+
+#include "trace.h"
+
+static const size_t DIFF_CONTEXT = 8;
+
+static std::string format(const TraceRecord &r)
+{
+    char buf[128];
+    switch (r.kind) {
+    case TRACE_INSTRUCTION:
+        snprintf(buf, sizeof(buf), "%12llu %04x  %02x      AF=%04x BC=%04x DE=%04x HL=%04x SP=%04x",
+                 (unsigned long long)r.cycles, r.pc, r.value, r.af, r.bc, r.de, r.hl, r.sp);
+        break;
+    case TRACE_READ:
+        snprintf(buf, sizeof(buf), "%12llu %04x  read    %04x -> %02x",
+                 (unsigned long long)r.cycles, r.pc, r.address, r.value);
+        break;
+    case TRACE_WRITE:
+        snprintf(buf, sizeof(buf), "%12llu %04x  write   %04x <- %02x",
+                 (unsigned long long)r.cycles, r.pc, r.address, r.value);
+        break;
+    case TRACE_INTERRUPT:
+        snprintf(buf, sizeof(buf), "%12llu %04x  irq %d   %04x",
+                 (unsigned long long)r.cycles, r.pc, r.value, r.address);
+        break;
+    default:
+        snprintf(buf, sizeof(buf), "%12llu %04x  unknown record %d",
+                 (unsigned long long)r.cycles, r.pc, r.kind);
+        break;
+    }
+    return buf;
+}
+
+static bool sameRecord(const TraceRecord &a, const TraceRecord &b)
+{
+    return a.cycles == b.cycles && a.pc == b.pc && a.af == b.af && a.bc == b.bc &&
+           a.de == b.de && a.hl == b.hl && a.sp == b.sp && a.address == b.address &&
+           a.kind == b.kind && a.value == b.value;
+}
+
+static int dump(const char *path)
+{
+    TraceReader reader(path);
+    if (!reader.isOpen())
+        return 2;
+
+    TraceRecord r;
+    while (reader.next(r))
+        puts(format(r).c_str());
+    return 0;
+}
+
+/* Prints the first record where the traces differ and what led up to it */
+static int diff(const char *pathA, const char *pathB)
+{
+    TraceReader a(pathA), b(pathB);
+    if (!a.isOpen() || !b.isOpen())
+        return 2;
+
+    std::deque<TraceRecord> context;
+    TraceRecord ra, rb;
+    for (unsigned long long n = 0; ; ++n) {
+        bool moreA = a.next(ra);
+        bool moreB = b.next(rb);
+        if (!moreA && !moreB)
+            return 0;
+
+        if (moreA && moreB && sameRecord(ra, rb)) {
+            context.push_back(ra);
+            if (context.size() > DIFF_CONTEXT)
+                context.pop_front();
+            continue;
+        }
+
+        printf("Traces differ at record %llu\n", n);
+        for (std::deque<TraceRecord>::iterator it = context.begin(); it != context.end(); ++it)
+            printf("  %s\n", format(*it).c_str());
+        printf("< %s\n", moreA ? format(ra).c_str() : "end of trace");
+        printf("> %s\n", moreB ? format(rb).c_str() : "end of trace");
+        return 1;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc == 3 && strcmp(argv[1], "dump") == 0)
+        return dump(argv[2]);
+    if (argc == 4 && strcmp(argv[1], "diff") == 0)
+        return diff(argv[2], argv[3]);
+
+    fprintf(stderr, "Usage: %s dump trace\n       %s diff trace1 trace2\n", argv[0], argv[0]);
+    return 2;
+}
@@ -0,0 +1,44 @@
+#ifndef TRIPLEBUFFER_H
+#define TRIPLEBUFFER_H
+
+#include <atomic>
+
+/*
+ * Hands values from one producer thread to one consumer thread without
+ * locks. The producer fills its back buffer and swaps it with the middle
+ * one; the consumer swaps its front buffer with the middle one when that
+ * holds something new. Neither side ever waits, and the consumer always
+ * sees the latest complete value.
+ */
+template <class T>
+class TripleBuffer
+{
+private:
+    static const int FRESH = 4;     /* the middle buffer was published since the last read */
+
+    T buffers[3];
+    int back;                       /* owned by the producer */
+    int front;                      /* owned by the consumer */
+    std::atomic<int> middle;        /* buffer index, plus FRESH */
+
+public:
+    TripleBuffer() : buffers(), back(0), front(1), middle(2) {};
+
+    T &writeBuffer() { return buffers[back]; };
+    void publish() {
+        back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & 3;
+    };
+
+    bool hasUpdate() const { return middle.load(std::memory_order_relaxed) & FRESH; };
+
+    /* Picks up the latest published value, returns false if there was none */
+    bool update() {
+        if (!hasUpdate())
+            return false;
+        front = middle.exchange(front, std::memory_order_acq_rel) & 3;
+        return true;
+    };
+    const T &readBuffer() const { return buffers[front]; };
+};
+
+#endif